@@ -4,12 +4,176 @@
 #include <vector>
 #include <algorithm>
 #include <limits>
-#include <stack>
 #include <random>
-#include <unordered_map>
+#include <chrono>
+#include <sstream>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <fstream>
+#include <map>
+#include <iomanip>
+#include <cmath>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// Logging, compiled in with -DCHESS_LOG_LEVEL=1..4 (error, info, debug, trace) and limited to the categories
+// in the CHESS_LOG_CATEGORIES bit mask. A LOG statement above the level or outside the categories is
+// discarded at compile time, message expression included, so default builds carry no logging code at all.
+// With CHESS_LOG_ASYNC the caller only formats its line and copies it into a ring buffer that a writer
+// thread drains; when the buffer is full the line is dropped rather than making the caller wait
+#ifndef CHESS_LOG_LEVEL
+#define CHESS_LOG_LEVEL 0
+#endif
+#ifndef CHESS_LOG_CATEGORIES
+#define CHESS_LOG_CATEGORIES 7
+#endif
+
+enum LogLevel { LOG_ERROR = 1, LOG_INFO, LOG_DEBUG, LOG_TRACE };
+enum LogCategory { LOG_MOVEGEN = 1, LOG_SEARCH = 2, LOG_IO = 4 };
+
+constexpr bool logEnabled(int level, int category) {
+    return level <= CHESS_LOG_LEVEL && (category & CHESS_LOG_CATEGORIES) != 0;
+}
+
+#define LOG(level, category, message)                    \
+    do {                                                 \
+        if constexpr (logEnabled(level, category)) {     \
+            ostringstream logLine;                       \
+            logLine << message;                          \
+            writeLog(level, category, logLine.str());    \
+        }                                                \
+    } while (0)
+
+#if CHESS_LOG_LEVEL > 0
+const char* const LOG_LEVEL_NAMES[] = {"", "error", "info", "debug", "trace"};
+const char* const LOG_CATEGORY_NAMES[] = {"", "movegen", "search", "", "io"};
+
+string logPath; // Lines are written here, or to stderr if empty
+ofstream logFile;
+ostream* logStream = &cerr;
+const chrono::steady_clock::time_point logStart = chrono::steady_clock::now();
+
+#ifdef CHESS_LOG_ASYNC
+const size_t LOG_RING_SIZE = 4096; // Power of two
+const size_t LOG_LINE_BYTES = 256; // Longer lines are cut
+
+// Bounded multi-producer, single-consumer ring. A slot's sequence number equals the position a producer
+// may claim it for while free, and that position + 1 once it holds a line for the writer
+struct LogRing {
+    struct Slot {
+        atomic<size_t> sequence;
+        char text[LOG_LINE_BYTES];
+    };
+    Slot slots[LOG_RING_SIZE];
+    atomic<size_t> head{0}; // Next position a producer claims
+    size_t tail = 0;        // Next position the writer reads
+    atomic<uint64_t> dropped{0};
+
+    LogRing() {
+        for (size_t i = 0; i < LOG_RING_SIZE; ++i) slots[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    void push(const string& line) {
+        size_t position = head.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[position & (LOG_RING_SIZE - 1)];
+            intptr_t lag = (intptr_t)slot.sequence.load(memory_order_acquire) - (intptr_t)position;
+            if (lag == 0 && head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                size_t length = min(line.size(), LOG_LINE_BYTES - 1);
+                memcpy(slot.text, line.data(), length);
+                slot.text[length] = '\0';
+                slot.sequence.store(position + 1, memory_order_release);
+                return;
+            }
+            if (lag < 0) {
+                dropped.fetch_add(1, memory_order_relaxed); // Full: the writer has not freed this slot yet
+                return;
+            }
+            if (lag > 0) position = head.load(memory_order_relaxed); // Another producer claimed it first
+        }
+    }
+
+    bool pop(string& line) {
+        Slot& slot = slots[tail & (LOG_RING_SIZE - 1)];
+        if (slot.sequence.load(memory_order_acquire) != tail + 1) return false;
+        line = slot.text;
+        slot.sequence.store(tail + LOG_RING_SIZE, memory_order_release);
+        tail++;
+        return true;
+    }
+};
+
+LogRing logRing;
+thread logWriter;
+atomic<bool> logStopping{false};
+
+// Writer thread: drain the ring, flushing whenever it runs dry
+void drainLog() {
+    string line;
+    while (true) {
+        bool stopping = logStopping.load(memory_order_acquire);
+        if (logRing.pop(line)) {
+            *logStream << line << '\n';
+            continue;
+        }
+        logStream->flush();
+        if (stopping) return;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+#else
+mutex logMutex;
+#endif
+
+void writeLog(int level, int category, const string& message) {
+    int64_t ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - logStart).count();
+    string line = to_string(ms) + " " + LOG_LEVEL_NAMES[level] + " " + LOG_CATEGORY_NAMES[category] + " " + message;
+#ifdef CHESS_LOG_ASYNC
+    logRing.push(line);
+#else
+    lock_guard<mutex> lock(logMutex);
+    *logStream << line << '\n';
+#endif
+}
+
+// Flush what is left at exit, and say how many lines the ring had to drop
+void stopLogging() {
+#ifdef CHESS_LOG_ASYNC
+    logStopping = true;
+    if (logWriter.joinable()) logWriter.join();
+    if (logRing.dropped) *logStream << logRing.dropped << " log lines dropped\n";
+#endif
+    logStream->flush();
+}
+
+void startLogging() {
+    if (!logPath.empty()) {
+        logFile.open(logPath, ios::app);
+        if (logFile) logStream = &logFile;
+        else cerr << "Could not open log file " << logPath << "; logging to stderr\n";
+    }
+#ifdef CHESS_LOG_ASYNC
+    logWriter = thread(drainLog);
+#endif
+    atexit(stopLogging);
+}
+#else
+inline void writeLog(int, int, const string&) {}
+inline void startLogging() {}
+#endif
+
 // Board constants
 const int BOARD_SIZE = 8;
 const uint64_t FILE_A = 0x0101010101010101ULL;
@@ -23,61 +187,31 @@ const uint64_t RANK_5 = 0x000000FF00000000ULL;
 const uint64_t RANK_7 = 0x00FF000000000000ULL;
 const uint64_t RANK_8 = 0xFF00000000000000ULL;
 
-// Piece bitboards
-uint64_t whitePawns, whiteKnights, whiteBishops, whiteRooks, whiteQueens, whiteKing;
-uint64_t blackPawns, blackKnights, blackBishops, blackRooks, blackQueens, blackKing;
-uint64_t whitePieces, blackPieces, allPieces;
-
-// Castling rights
-bool whiteKingsideCastle = true, whiteQueensideCastle = true;
-bool blackKingsideCastle = true, blackQueensideCastle = true;
-
-// En passant target square
-uint64_t enPassantTarget = 0;
+// Piece indices, in the same order as the rows of zobristTable
+enum Piece {
+    WHITE_PAWN, WHITE_KNIGHT, WHITE_BISHOP, WHITE_ROOK, WHITE_QUEEN, WHITE_KING,
+    BLACK_PAWN, BLACK_KNIGHT, BLACK_BISHOP, BLACK_ROOK, BLACK_QUEEN, BLACK_KING,
+    NO_PIECE
+};
 
-stack<uint64_t> zobristHistory; // For undoing Zobrist hashes efficiently
 uint64_t zobristTable[12][64];  // Randomized Zobrist keys for hashing
-unordered_map<uint64_t, pair<int, int>> transpositionTable;
+uint64_t zobristSideKey;        // XORed in when Black is to move
+uint64_t zobristCastlingKeys[4]; // White kingside, white queenside, black kingside, black queenside
+uint64_t zobristEnPassantKeys[8]; // File of the en passant target square
 
 // Initialize Zobrist hashing
 void initializeZobrist() {
-    random_device rd;
-    mt19937_64 gen(rd());
-    uniform_int_distribution<uint64_t> dist(0, UINT64_MAX);
+    // Fixed seed, and the raw engine output rather than a distribution, so keys are identical on every run and platform
+    mt19937_64 gen(0x3243F6A8885A308DULL);
 
     for (int piece = 0; piece < 12; ++piece) {
         for (int square = 0; square < 64; ++square) {
-            zobristTable[piece][square] = dist(gen);
+            zobristTable[piece][square] = gen();
         }
     }
-}
-
-// Initialize board position
-void initializePosition() {
-    whitePawns = 0x000000000000FF00ULL;
-    whiteKnights = 0x0000000000000042ULL;
-    whiteBishops = 0x0000000000000024ULL;
-    whiteRooks = 0x0000000000000081ULL;
-    whiteQueens = 0x0000000000000008ULL;
-    whiteKing = 0x0000000000000010ULL;
-
-    blackPawns = 0x00FF000000000000ULL;
-    blackKnights = 0x4200000000000000ULL;
-    blackBishops = 0x2400000000000000ULL;
-    blackRooks = 0x8100000000000000ULL;
-    blackQueens = 0x0800000000000000ULL;
-    blackKing = 0x1000000000000000ULL;
-
-    whitePieces = whitePawns | whiteKnights | whiteBishops | whiteRooks | whiteQueens | whiteKing;
-    blackPieces = blackPawns | blackKnights | blackBishops | blackRooks | blackQueens | blackKing;
-    allPieces = whitePieces | blackPieces;
-
-    whiteKingsideCastle = whiteQueensideCastle = true;
-    blackKingsideCastle = blackQueensideCastle = true;
-    enPassantTarget = 0;
-
-    // Initialize Zobrist hash for the initial position
-    zobristHistory.push(0); // Push an initial Zobrist hash (to be calculated dynamically)
+    zobristSideKey = gen();
+    for (uint64_t& key : zobristCastlingKeys) key = gen();
+    for (uint64_t& key : zobristEnPassantKeys) key = gen();
 }
 
 
@@ -97,807 +231,4484 @@ void printBitboard(uint64_t bitboard) {
 
 
 // Sliding piece moves (rooks and bishops), with blockers
+// Reference implementation: only used to build and verify the attack tables below
 uint64_t slideMove(uint64_t piece, int direction, uint64_t blockers) {
     uint64_t moves = 0;
     uint64_t temp = piece;
 
     while (temp) {
+        if ((temp & FILE_H) && (direction == 1 || direction == -7 || direction == 9)) break;  // Prevent wrap from H to A
+        if ((temp & FILE_A) && (direction == -1 || direction == 7 || direction == -9)) break; // Prevent wrap from A to H
         temp = (direction > 0) ? (temp << direction) : (temp >> -direction);
-        if (temp & blockers) {  // Stop at blockers
-            moves |= temp;      // Include the blocker square for capture
-            break;
-        }
-        if ((temp & FILE_A) && (direction == -1 || direction == 7 || direction == -9)) break; // Prevent wrap from H to A
-        if ((temp & FILE_H) && (direction == 1 || direction == -7 || direction == 9)) break;  // Prevent wrap from A to H
         moves |= temp;
+        if (temp & blockers) break; // Stop at blockers (the blocker square is included for captures)
     }
     return moves;
 }
 
 
-// Expanded function to check if a square is attacked by any enemy piece
-bool isSquareAttacked(uint64_t square, bool byWhite) {
-    uint64_t enemyPawns = byWhite ? whitePawns : blackPawns;
-    uint64_t enemyKnights = byWhite ? whiteKnights : blackKnights;
-    uint64_t enemyBishops = byWhite ? whiteBishops : blackBishops;
-    uint64_t enemyRooks = byWhite ? whiteRooks : blackRooks;
-    uint64_t enemyQueens = byWhite ? whiteQueens : blackQueens;
-    uint64_t enemyKing = byWhite ? whiteKing : blackKing;
-    uint64_t enemyPieces = byWhite ? whitePieces : blackPieces;
-
-    // Pawn attacks
-    if (byWhite) {
-        if (((enemyPawns << 7) & ~FILE_H & square) || ((enemyPawns << 9) & ~FILE_A & square)) {
-            return true; // White Pawn attacking left or right
-        }
-    } else {
-        if (((enemyPawns >> 7) & ~FILE_A & square) || ((enemyPawns >> 9) & ~FILE_H & square)) {
-            return true; // Black Pawn attacking left or right
-        }
-    }
-
-    // Knight attacks
-    uint64_t knightAttacks = ((square << 17) & ~FILE_A) | ((square << 15) & ~FILE_H) |
-                             ((square >> 17) & ~FILE_H) | ((square >> 15) & ~FILE_A) |
-                             ((square << 10) & ~(FILE_A | FILE_B)) | ((square >> 10) & ~(FILE_H | FILE_G)) |
-                             ((square << 6) & ~(FILE_H | FILE_G)) | ((square >> 6) & ~(FILE_A | FILE_B));
-    if (enemyKnights & knightAttacks) return true;
+// Magic bitboards: one table lookup per slider instead of up to eight slideMove loops
+struct Magic {
+    uint64_t mask;      // Relevant occupancy (board edges excluded)
+    uint64_t magic;     // Multiplier used when PEXT is not available
+    uint64_t* attacks;  // Start of this square's slice of the attack table
+    int shift;
+};
 
-    // Sliding piece attacks (bishops, rooks, queens)
-    uint64_t bishopAttacks = slideMove(square, 7, enemyPieces) | slideMove(square, 9, enemyPieces) |
-                             slideMove(square, -7, enemyPieces) | slideMove(square, -9, enemyPieces);
-    if (enemyBishops & bishopAttacks || enemyQueens & bishopAttacks) return true;
+Magic rookMagics[64];
+Magic bishopMagics[64];
+uint64_t rookAttackTable[0x19000];  // Sum of 2^bits over all squares for rooks
+uint64_t bishopAttackTable[0x1480]; // Same for bishops
+bool usePext = false;               // Index with BMI2 PEXT instead of the magic multiply
 
-    uint64_t rookAttacks = slideMove(square, 1, enemyPieces) | slideMove(square, -1, enemyPieces) |
-                           slideMove(square, 8, enemyPieces) | slideMove(square, -8, enemyPieces);
-    if (enemyRooks & rookAttacks || enemyQueens & rookAttacks) return true;
+const int ROOK_DIRECTIONS[4] = {8, -8, 1, -1};
+const int BISHOP_DIRECTIONS[4] = {9, 7, -9, -7};
 
-    // King attacks
-    uint64_t kingAttacks = (square << 8) | (square >> 8) |
-                           ((square << 1) & ~FILE_A) | ((square >> 1) & ~FILE_H) |
-                           ((square << 9) & ~FILE_A) | ((square >> 9) & ~FILE_H) |
-                           ((square << 7) & ~FILE_H) | ((square >> 7) & ~FILE_A);
-    if (enemyKing & kingAttacks) return true;
+// PEXT through inline asm so the rest of the file does not need -mbmi2; only executed when usePext is set
+inline uint64_t pext(uint64_t value, uint64_t mask) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    uint64_t result;
+    asm("pextq %2, %1, %0" : "=r"(result) : "r"(value), "r"(mask));
+    return result;
+#else
+    uint64_t result = 0;
+    for (uint64_t bit = 1; mask; bit <<= 1) {
+        if (value & mask & -mask) result |= bit;
+        mask &= mask - 1;
+    }
+    return result;
+#endif
+}
 
+bool cpuSupportsBmi2() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+#else
     return false;
+#endif
 }
 
+inline unsigned magicIndex(const Magic& m, uint64_t occupied) {
+    if (usePext) return (unsigned)pext(occupied, m.mask);
+    return (unsigned)(((occupied & m.mask) * m.magic) >> m.shift);
+}
 
-// Convert a square in bitboard format to chess notation (e.g., 1ULL << 0 -> "a1")
-string squareToNotation(uint64_t square) {
-    if (square == 0) {
-        return "null"; // Handle case where square is invalid
-    }
-
-    // Get the index of the square (position of the least significant bit)
-    int index = __builtin_ctzll(square); // Count trailing zeros (find the bit position)
-
-    // Convert the index into file (column) and rank (row)
-    char file = 'a' + (index % 8);      // Files are a-h (0-7 mod 8)
-    char rank = '1' + (index / 8);      // Ranks are 1-8 (0-7 div 8)
-
-    return string(1, file) + string(1, rank); // Combine file and rank into a single string
+inline uint64_t rookAttacks(int square, uint64_t occupied) {
+    const Magic& m = rookMagics[square];
+    return m.attacks[magicIndex(m, occupied)];
 }
 
-// Function to check if a move is legal
-bool isMoveLegal(uint64_t fromSquare, uint64_t toSquare, bool isWhite) {
-    uint64_t savedWhitePieces = whitePieces;
-    uint64_t savedBlackPieces = blackPieces;
-    uint64_t savedAllPieces = allPieces;
-    uint64_t king = isWhite ? whiteKing : blackKing;
+inline uint64_t bishopAttacks(int square, uint64_t occupied) {
+    const Magic& m = bishopMagics[square];
+    return m.attacks[magicIndex(m, occupied)];
+}
 
-    // Temporarily make the move
-    if (isWhite) {
-        whitePieces ^= fromSquare | toSquare;
-        allPieces = whitePieces | blackPieces;
-    } else {
-        blackPieces ^= fromSquare | toSquare;
-        allPieces = whitePieces | blackPieces;
-    }
+inline uint64_t queenAttacks(int square, uint64_t occupied) {
+    return rookAttacks(square, occupied) | bishopAttacks(square, occupied);
+}
 
-    // Check if the king is in check
-    bool kingInCheck = isSquareAttacked(king, !isWhite);
-    if (kingInCheck) {
-        cout << "Move from " << squareToNotation(fromSquare) << " to " << squareToNotation(toSquare)
-             << " leaves king in check. Illegal.\n";
+uint64_t slideAttacks(int square, const int directions[4], uint64_t occupied) {
+    uint64_t attacks = 0;
+    for (int i = 0; i < 4; ++i) {
+        attacks |= slideMove(1ULL << square, directions[i], occupied);
     }
-
-    // Restore original positions
-    whitePieces = savedWhitePieces;
-    blackPieces = savedBlackPieces;
-    allPieces = savedAllPieces;
-
-    return !kingInCheck;
+    return attacks;
 }
 
+// Deterministic xorshift generator so magic search gives the same tables on every run
+uint64_t magicRandom(uint64_t& state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
 
-
-
-// Enhanced print function to display the board for players
-void printBoardForPlayers() {
-    cout << "\nCurrent Board:\n";
-    cout << "  a b c d e f g h\n +----------------+\n";
-    for (int rank = 7; rank >= 0; --rank) {
-        cout << rank + 1 << "| ";
-        for (int file = 0; file < 8; ++file) {
-            int square = rank * 8 + file;
-            uint64_t mask = 1ULL << square;
-            if (whitePawns & mask) cout << "P ";
-            else if (whiteKnights & mask) cout << "N ";
-            else if (whiteBishops & mask) cout << "B ";
-            else if (whiteRooks & mask) cout << "R ";
-            else if (whiteQueens & mask) cout << "Q ";
-            else if (whiteKing & mask) cout << "K ";
-            else if (blackPawns & mask) cout << "p ";
-            else if (blackKnights & mask) cout << "n ";
-            else if (blackBishops & mask) cout << "b ";
-            else if (blackRooks & mask) cout << "r ";
-            else if (blackQueens & mask) cout << "q ";
-            else if (blackKing & mask) cout << "k ";
-            else cout << ". ";
+void initializeSliderTable(Magic magics[64], uint64_t* table, const int directions[4]) {
+    uint64_t occupancies[4096], references[4096];
+    int epochs[4096] = {0};
+    int epoch = 0;
+    uint64_t* next = table;
+    // Per-rank seeds known to find magics quickly with this generator
+    const uint64_t RANK_SEEDS[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+
+    for (int square = 0; square < 64; ++square) {
+        Magic& m = magics[square];
+        int rank = square / 8, file = square % 8;
+        uint64_t edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * rank))) |
+                         ((FILE_A | FILE_H) & ~(FILE_A << file));
+        m.mask = slideAttacks(square, directions, 0) & ~edges;
+        int bits = __builtin_popcountll(m.mask);
+        m.shift = 64 - bits;
+        m.attacks = next;
+        next += 1ULL << bits;
+
+        // Carry-Rippler enumeration of every subset of the mask
+        int size = 0;
+        uint64_t subset = 0;
+        do {
+            occupancies[size] = subset;
+            references[size] = slideAttacks(square, directions, subset);
+            if (usePext) m.attacks[pext(subset, m.mask)] = references[size];
+            size++;
+            subset = (subset - m.mask) & m.mask;
+        } while (subset);
+
+        if (usePext) continue;
+
+        uint64_t seed = RANK_SEEDS[rank];
+        // Search for a multiplier that maps every subset without destructive collisions
+        for (int i = 0; i < size;) {
+            do {
+                m.magic = magicRandom(seed) & magicRandom(seed) & magicRandom(seed);
+            } while (__builtin_popcountll((m.magic * m.mask) >> 56) < 6);
+
+            ++epoch;
+            for (i = 0; i < size; ++i) {
+                unsigned index = (unsigned)((occupancies[i] * m.magic) >> m.shift);
+                if (epochs[index] < epoch) {
+                    epochs[index] = epoch;
+                    m.attacks[index] = references[i];
+                } else if (m.attacks[index] != references[i]) {
+                    break;
+                }
+            }
         }
-        cout << "|\n";
     }
-    cout << " +----------------+\n";
 }
 
-vector<uint64_t> generatePawnMoves(uint64_t pawns, bool isWhite) {
-    vector<uint64_t> moves;
-    uint64_t singleStep, doubleStep, attacksLeft, attacksRight;
+// Build rook and bishop attack tables, indexed with PEXT when the CPU has BMI2
+void initializeSliderAttacks(bool allowPext = true) {
+    usePext = allowPext && cpuSupportsBmi2();
+    initializeSliderTable(rookMagics, rookAttackTable, ROOK_DIRECTIONS);
+    initializeSliderTable(bishopMagics, bishopAttackTable, BISHOP_DIRECTIONS);
+}
 
-    if (isWhite) {
-        singleStep = (pawns << 8) & ~allPieces;
-        doubleStep = ((pawns & RANK_2) << 16) & ~allPieces & ~(allPieces << 8);
-        attacksLeft = (pawns << 7) & blackPieces & ~FILE_H;
-        attacksRight = (pawns << 9) & blackPieces & ~FILE_A;
-    } else {
-        singleStep = (pawns >> 8) & ~allPieces;
-        doubleStep = ((pawns & RANK_7) >> 16) & ~allPieces & ~(allPieces >> 8);
-        attacksLeft = (pawns >> 7) & whitePieces & ~FILE_A;
-        attacksRight = (pawns >> 9) & whitePieces & ~FILE_H;
+// Compare table lookups with slideMove over random occupancies for every square
+bool verifySliderAttacks(int samplesPerSquare = 2000) {
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    for (int square = 0; square < 64; ++square) {
+        for (int i = 0; i < samplesPerSquare; ++i) {
+            uint64_t occupied = magicRandom(seed) & magicRandom(seed);
+            if (rookAttacks(square, occupied) != slideAttacks(square, ROOK_DIRECTIONS, occupied) ||
+                bishopAttacks(square, occupied) != slideAttacks(square, BISHOP_DIRECTIONS, occupied)) {
+                cout << "Slider table mismatch on square " << square << " with occupancy " << occupied << "\n";
+                return false;
+            }
+        }
     }
-
-    // Debug output
-    cout << "Pawn moves generated: ";
-    if (singleStep) cout << singleStep << " ";
-    if (doubleStep) cout << doubleStep << " ";
-    if (attacksLeft) cout << attacksLeft << " ";
-    if (attacksRight) cout << attacksRight << " ";
-    cout << endl;
-
-    if (singleStep) moves.push_back(singleStep);
-    if (doubleStep) moves.push_back(doubleStep);
-    if (attacksLeft) moves.push_back(attacksLeft);
-    if (attacksRight) moves.push_back(attacksRight);
-
-    return moves;
+    return true;
 }
 
-
-// Generate knight moves
-vector<uint64_t> generateKnightMoves(uint64_t knights, bool isWhite) {
-    vector<uint64_t> moves;
-    uint64_t targets = isWhite ? blackPieces : whitePieces;
-    uint64_t potentialMoves;
-
-    while (knights) {
-        // Isolate the least significant knight piece
-        uint64_t knight = knights & -knights;
-        knights &= knights - 1;
-
-        // Generate potential moves by shifting and masking
-        potentialMoves = ((knight << 17) & ~FILE_A) | ((knight << 15) & ~FILE_H) |
-                         ((knight << 10) & ~(FILE_A | FILE_B)) | ((knight << 6) & ~(FILE_G | FILE_H)) |
-                         ((knight >> 17) & ~FILE_H) | ((knight >> 15) & ~FILE_A) |
-                         ((knight >> 10) & ~(FILE_G | FILE_H)) | ((knight >> 6) & ~(FILE_A | FILE_B));
-
-        // Remove own pieces from potential moves and add to moves list
-        moves.push_back(potentialMoves & ~targets);
+uint64_t betweenTable[64][64]; // Squares strictly between two squares on a shared rank, file or diagonal
+uint64_t lineTable[64][64];    // The whole rank, file or diagonal through two squares, or 0 if they share none
+
+void initializeLineTables() {
+    for (int a = 0; a < 64; ++a) {
+        for (int b = 0; b < 64; ++b) {
+            betweenTable[a][b] = lineTable[a][b] = 0;
+            if (a == b) continue;
+            for (const int* directions : {ROOK_DIRECTIONS, BISHOP_DIRECTIONS}) {
+                if (!(slideAttacks(a, directions, 0) & (1ULL << b))) continue;
+                lineTable[a][b] = (slideAttacks(a, directions, 0) & slideAttacks(b, directions, 0)) | (1ULL << a) | (1ULL << b);
+                betweenTable[a][b] = slideAttacks(a, directions, 1ULL << b) & slideAttacks(b, directions, 1ULL << a);
+            }
+        }
     }
-    return moves;
 }
 
 
-// Generate bishop moves (diagonals)
-vector<uint64_t> generateBishopMoves(uint64_t bishops, bool isWhite) {
-    vector<uint64_t> moves;
-    uint64_t targets = isWhite ? blackPieces : whitePieces;
 
-    while (bishops) {
-        uint64_t bishop = bishops & -bishops;
-        bishops &= bishops - 1;
-        uint64_t diagonalMoves = slideMove(bishop, 9, allPieces) | slideMove(bishop, 7, allPieces) |
-                                 slideMove(bishop, -9, allPieces) | slideMove(bishop, -7, allPieces);
-        moves.push_back(diagonalMoves & ~targets);
+// Convert a square in bitboard format to chess notation (e.g., 1ULL << 0 -> "a1")
+string squareToNotation(uint64_t square) {
+    if (square == 0) {
+        return "null"; // Handle case where square is invalid
     }
-    return moves;
-}
-
-// Generate rook moves (straight lines)
-vector<uint64_t> generateRookMoves(uint64_t rooks, bool isWhite) {
-    vector<uint64_t> moves;
-    uint64_t targets = isWhite ? blackPieces : whitePieces;
 
-    while (rooks) {
-        uint64_t rook = rooks & -rooks;
-        rooks &= rooks - 1;
-        uint64_t straightMoves = slideMove(rook, 8, allPieces) | slideMove(rook, -8, allPieces) |
-                                 slideMove(rook, 1, allPieces) | slideMove(rook, -1, allPieces);
-        moves.push_back(straightMoves & ~targets);
-    }
-    return moves;
-}
+    // Get the index of the square (position of the least significant bit)
+    int index = __builtin_ctzll(square); // Count trailing zeros (find the bit position)
 
-// Generate queen moves by combining rook and bishop moves
-vector<uint64_t> generateQueenMoves(uint64_t queens, bool isWhite) {
-    vector<uint64_t> moves;
-    uint64_t targets = isWhite ? blackPieces : whitePieces;
+    // Convert the index into file (column) and rank (row)
+    char file = 'a' + (index % 8);      // Files are a-h (0-7 mod 8)
+    char rank = '1' + (index / 8);      // Ranks are 1-8 (0-7 div 8)
 
-    while (queens) {
-        uint64_t queen = queens & -queens;
-        queens &= queens - 1;
-        uint64_t queenMoves = slideMove(queen, 8, allPieces) | slideMove(queen, -8, allPieces) |
-                              slideMove(queen, 1, allPieces) | slideMove(queen, -1, allPieces) |
-                              slideMove(queen, 9, allPieces) | slideMove(queen, 7, allPieces) |
-                              slideMove(queen, -9, allPieces) | slideMove(queen, -7, allPieces);
-        moves.push_back(queenMoves & ~targets);
-    }
-    return moves;
+    return string(1, file) + string(1, rank); // Combine file and rank into a single string
 }
 
-// Generate king moves
-vector<uint64_t> generateKingMoves(uint64_t king, bool isWhite) {
-    vector<uint64_t> moves;
-    uint64_t targets = isWhite ? blackPieces : whitePieces;
 
-    uint64_t kingMoves = ((king << 8) | (king >> 8) | ((king & ~FILE_H) << 1) | ((king & ~FILE_A) >> 1) |
-                          ((king & ~FILE_H) << 9) | ((king & ~FILE_A) << 7) |
-                          ((king & ~FILE_H) >> 7) | ((king & ~FILE_A) >> 9));
-    moves.push_back(kingMoves & ~targets);
+// Compact 16-bit move: bits 0-5 from square, bits 6-11 to square, bits 12-15 flags
+typedef uint16_t Move;
+const Move NULL_MOVE = 0;
+
+enum MoveFlag {
+    QUIET = 0,
+    DOUBLE_PAWN_PUSH = 1,
+    KING_CASTLE = 2,
+    QUEEN_CASTLE = 3,
+    CAPTURE = 4,
+    EN_PASSANT = 5,
+    KNIGHT_PROMOTION = 8,  // Promotion flags are 8-11 (N, B, R, Q); adding CAPTURE gives 12-15
+    BISHOP_PROMOTION = 9,
+    ROOK_PROMOTION = 10,
+    QUEEN_PROMOTION = 11
+};
 
-    return moves;
+inline Move encodeMove(int from, int to, int flags) {
+    return (Move)(from | (to << 6) | (flags << 12));
 }
 
-// Castling check
-bool canCastleKingside(bool isWhite) {
-    uint64_t kingPosition = isWhite ? whiteKing : blackKing;
-    uint64_t rookPosition = isWhite ? whiteRooks : blackRooks;
-    uint64_t kingsideMask = isWhite ? 0x60ULL : 0x6000000000000000ULL;
-
-    // Ensure the squares between king and rook are empty, and check that the squares the king will move over are safe
-    bool kingsideAvailable = (isWhite ? whiteKingsideCastle : blackKingsideCastle) &&
-                             !(allPieces & kingsideMask) &&
-                             !isSquareAttacked(kingPosition, !isWhite) &&
-                             !isSquareAttacked(kingPosition << 1, !isWhite) &&
-                             !isSquareAttacked(kingPosition << 2, !isWhite);
-    return kingsideAvailable;
+inline int moveFrom(Move move) { return move & 63; }
+inline int moveTo(Move move) { return (move >> 6) & 63; }
+inline int moveFlags(Move move) { return move >> 12; }
+inline bool isCaptureMove(Move move) { return moveFlags(move) & CAPTURE; }
+inline bool isPromotionMove(Move move) { return moveFlags(move) & 8; }
+
+// Long algebraic notation, e.g. "e2e4" or "e7e8q"
+string moveToString(Move move) {
+    if (move == NULL_MOVE) return "0000";
+    string text = squareToNotation(1ULL << moveFrom(move)) + squareToNotation(1ULL << moveTo(move));
+    if (isPromotionMove(move)) text += "nbrq"[moveFlags(move) & 3];
+    return text;
 }
 
-// Checks if the king can castle
-bool canCastleQueenside(bool isWhite) {
-    uint64_t kingPosition = isWhite ? whiteKing : blackKing;
-    uint64_t rookPosition = isWhite ? whiteRooks : blackRooks;
-    uint64_t queensideMask = isWhite ? 0xEULL : 0xE00000000000000ULL;
-
-    bool queensideAvailable = (isWhite ? whiteQueensideCastle : blackQueensideCastle) &&
-                              !(allPieces & queensideMask) &&
-                              !isSquareAttacked(kingPosition, !isWhite) &&
-                              !isSquareAttacked(kingPosition >> 1, !isWhite) &&
-                              !isSquareAttacked(kingPosition >> 2, !isWhite);
-    return queensideAvailable;
-}
-
-// En passant move generation
-vector<uint64_t> generateEnPassantMoves(uint64_t pawns, bool isWhite) {
-    vector<uint64_t> moves;
-    if (enPassantTarget == 0) return moves;
-
-    uint64_t enPassantLeft = isWhite ? (pawns << 7) & ~FILE_H & enPassantTarget
-                                      : (pawns >> 7) & ~FILE_A & enPassantTarget;
-    uint64_t enPassantRight = isWhite ? (pawns << 9) & ~FILE_A & enPassantTarget
-                                       : (pawns >> 9) & ~FILE_H & enPassantTarget;
-
-    if (enPassantLeft) moves.push_back(enPassantLeft);
-    if (enPassantRight) moves.push_back(enPassantRight);
-    return moves;
-}
+// Fixed-capacity move list kept on the stack (256 is above the maximum of 218 moves in any position)
+struct MoveList {
+    Move moves[256];
+    int count = 0;
+
+    void add(Move move) { moves[count++] = move; }
+    int size() const { return count; }
+    Move& operator[](int index) { return moves[index]; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+    const Move* begin() const { return moves; }
+    const Move* end() const { return moves + count; }
+};
 
 
+// NNUE: a (768 -> 256) x 2 -> 1 network. Each side has an accumulator holding the hidden layer
+// before activation, seen from its own side of the board, and updated piece by piece as moves are made.
+// The output clips both accumulators to [0, QA] and takes a dot product with the output weights,
+// side to move first. Weights are int16 throughout, quantised by QA for the feature transformer and
+// QB for the output layer
+const int NNUE_INPUTS = 768;  // 2 colors x 6 piece types x 64 squares
+const int NNUE_HIDDEN = 256;
+const int NNUE_QA = 255;
+const int NNUE_QB = 64;
+const int NNUE_SCALE = 400;   // Output units per centipawn scale
+
+struct Network {
+    alignas(32) int16_t featureWeights[NNUE_INPUTS][NNUE_HIDDEN];
+    alignas(32) int16_t featureBias[NNUE_HIDDEN];
+    alignas(32) int16_t outputWeights[2 * NNUE_HIDDEN]; // Side to move's half first
+    int16_t outputBias;
+};
 
-// Parse move input like "e2 e4" to bitboard squares
-pair<int, int> parseInput(const string& input) {
-    int fileFrom = input[0] - 'a';
-    int rankFrom = input[1] - '1';
-    int fileTo = input[3] - 'a';
-    int rankTo = input[4] - '1';
+Network network;
+bool useNnue = false; // Set once a network is loaded; positions then keep their accumulators up to date
 
-    int fromSquare = rankFrom * 8 + fileFrom;
-    int toSquare = rankTo * 8 + fileTo;
-    return {fromSquare, toSquare};
-}
+// Accumulator and output kernels, one set per instruction set and chosen at runtime
+enum NnueBackend { NNUE_SCALAR, NNUE_SSE41, NNUE_AVX2 };
+const char* NNUE_BACKEND_NAMES[] = {"scalar", "sse4.1", "avx2"};
 
-// Enhanced function to determine if a position is checkmate or stalemate
-bool isCheckmateOrStalemate(bool isWhiteTurn) {
-    uint64_t king = isWhiteTurn ? whiteKing : blackKing;
-    bool kingInCheck = isSquareAttacked(king, !isWhiteTurn);
-
-    // Iterate over all pieces of the current player and try all possible moves
-    uint64_t pieces = isWhiteTurn ? whitePieces : blackPieces;
-    while (pieces) {
-        uint64_t piece = pieces & -pieces; // Isolate the least significant bit (current piece)
-        pieces &= pieces - 1;              // Remove the isolated piece from the set
-
-        // Generate all legal moves for this piece
-        vector<uint64_t> legalMoves;
-        if (isWhiteTurn) {
-            if (whitePawns & piece) legalMoves = generatePawnMoves(piece, true);
-            else if (whiteKnights & piece) legalMoves = generateKnightMoves(piece, true);
-            else if (whiteBishops & piece) legalMoves = generateBishopMoves(piece, true);
-            else if (whiteRooks & piece) legalMoves = generateRookMoves(piece, true);
-            else if (whiteQueens & piece) legalMoves = generateQueenMoves(piece, true);
-            else if (whiteKing & piece) legalMoves = generateKingMoves(piece, true);
-        } else {
-            if (blackPawns & piece) legalMoves = generatePawnMoves(piece, false);
-            else if (blackKnights & piece) legalMoves = generateKnightMoves(piece, false);
-            else if (blackBishops & piece) legalMoves = generateBishopMoves(piece, false);
-            else if (blackRooks & piece) legalMoves = generateRookMoves(piece, false);
-            else if (blackQueens & piece) legalMoves = generateQueenMoves(piece, false);
-            else if (blackKing & piece) legalMoves = generateKingMoves(piece, false);
-        }
-
-        // Check each legal move to see if it leaves the king safe
-        for (uint64_t move : legalMoves) {
-            if (isMoveLegal(piece, move, isWhiteTurn)) {
-                // If at least one legal move exists, it's not checkmate or stalemate
-                return false;
-            }
-        }
-    }
+struct NnueKernels {
+    void (*addRow)(int16_t* accumulator, const int16_t* row);
+    void (*subRow)(int16_t* accumulator, const int16_t* row);
+    int32_t (*output)(const int16_t* us, const int16_t* them, const int16_t* weights);
+};
 
-    // If no legal moves and king is in check, it's checkmate; otherwise, stalemate
-    return kingInCheck;
+void addRowScalar(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) accumulator[i] += row[i];
 }
 
-// Handle pawn promotion to a queen when reaching last rank
-void handlePawnPromotion(uint64_t toBit, uint64_t isWhiteTurn) {
-    if (isWhiteTurn && (toBit & RANK_8)) {
-        whitePawns ^= toBit;
-        whiteQueens |= toBit;
-    }else if(!isWhiteTurn && (toBit & RANK_1)) {
-        blackPawns ^= toBit;
-        blackQueens |= toBit;
-    }
-    whitePieces = whitePawns | whiteKnights | whiteBishops | whiteRooks | whiteQueens | whiteKing;
-    blackPieces = blackPawns | blackKnights | blackBishops | blackRooks | blackQueens | blackKing;
-    allPieces = whitePieces | blackPieces;
+void subRowScalar(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) accumulator[i] -= row[i];
 }
 
-
-// Main move function with updated castling and en passant checks
-bool makeMove(int fromSquare, int toSquare, bool isWhiteTurn) {
-    uint64_t fromBit = 1ULL << fromSquare;
-    uint64_t toBit = 1ULL << toSquare;
-
-    // Debug move attempt
-    cout << "Attempting move: " << squareToNotation(fromBit) << " -> " << squareToNotation(toBit) << "\n";
-
-    // Generate legal moves for the piece
-    vector<uint64_t> legalMoves;
-    if (isWhiteTurn) {
-        if (whitePawns & fromBit) legalMoves = generatePawnMoves(fromBit, true);
-        else if (whiteKnights & fromBit) legalMoves = generateKnightMoves(fromBit, true);
-        else if (whiteBishops & fromBit) legalMoves = generateBishopMoves(fromBit, true);
-        else if (whiteRooks & fromBit) legalMoves = generateRookMoves(fromBit, true);
-        else if (whiteQueens & fromBit) legalMoves = generateQueenMoves(fromBit, true);
-        else if (whiteKing & fromBit) legalMoves = generateKingMoves(fromBit, true);
-    } else {
-        if (blackPawns & fromBit) legalMoves = generatePawnMoves(fromBit, false);
-        else if (blackKnights & fromBit) legalMoves = generateKnightMoves(fromBit, false);
-        else if (blackBishops & fromBit) legalMoves = generateBishopMoves(fromBit, false);
-        else if (blackRooks & fromBit) legalMoves = generateRookMoves(fromBit, false);
-        else if (blackQueens & fromBit) legalMoves = generateQueenMoves(fromBit, false);
-        else if (blackKing & fromBit) legalMoves = generateKingMoves(fromBit, false);
+int32_t outputScalar(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        sum += min(max((int32_t)us[i], 0), NNUE_QA) * weights[i];
+        sum += min(max((int32_t)them[i], 0), NNUE_QA) * weights[NNUE_HIDDEN + i];
     }
+    return sum;
+}
 
-    // Debugging legal moves
-    cout << "Legal moves for " << squareToNotation(fromBit) << ": ";
-    for (uint64_t move : legalMoves) {
-        cout << squareToNotation(move) << " ";
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("sse4.1"))) void addRowSse41(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i* target = (__m128i*)(accumulator + i);
+        _mm_store_si128(target, _mm_add_epi16(_mm_load_si128(target), _mm_load_si128((const __m128i*)(row + i))));
     }
-    cout << endl;
+}
 
-    if (find(legalMoves.begin(), legalMoves.end(), toBit) == legalMoves.end()) {
-        cout << "Move is not in the list of legal moves. Illegal.\n";
-        return false;
+__attribute__((target("sse4.1"))) void subRowSse41(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i* target = (__m128i*)(accumulator + i);
+        _mm_store_si128(target, _mm_sub_epi16(_mm_load_si128(target), _mm_load_si128((const __m128i*)(row + i))));
     }
+}
 
-    // King safety check
-    if (!isMoveLegal(fromBit, toBit, isWhiteTurn)) {
-        cout << "Move leaves the king in check. Illegal.\n";
-        return false;
+__attribute__((target("sse4.1"))) int32_t outputSse41(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const __m128i zero = _mm_setzero_si128(), qa = _mm_set1_epi16(NNUE_QA);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i ourValues = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i*)(us + i)), zero), qa);
+        __m128i theirValues = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i*)(them + i)), zero), qa);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(ourValues, _mm_load_si128((const __m128i*)(weights + i))));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(theirValues, _mm_load_si128((const __m128i*)(weights + NNUE_HIDDEN + i))));
     }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
 
-    // Apply the move
-    cout << "Move is valid. Applying move.\n";
-    if (isWhiteTurn) {
-        whitePieces ^= fromBit | toBit;
-        allPieces = whitePieces | blackPieces;
-
-        if (whitePawns & fromBit) whitePawns ^= fromBit | toBit;
-        else if (whiteKnights & fromBit) whiteKnights ^= fromBit | toBit;
-        else if (whiteBishops & fromBit) whiteBishops ^= fromBit | toBit;
-        else if (whiteRooks & fromBit) whiteRooks ^= fromBit | toBit;
-        else if (whiteQueens & fromBit) whiteQueens ^= fromBit | toBit;
-        else if (whiteKing & fromBit) whiteKing ^= fromBit | toBit;
-    } else {
-        blackPieces ^= fromBit | toBit;
-        allPieces = whitePieces | blackPieces;
-
-        if (blackPawns & fromBit) blackPawns ^= fromBit | toBit;
-        else if (blackKnights & fromBit) blackKnights ^= fromBit | toBit;
-        else if (blackBishops & fromBit) blackBishops ^= fromBit | toBit;
-        else if (blackRooks & fromBit) blackRooks ^= fromBit | toBit;
-        else if (blackQueens & fromBit) blackQueens ^= fromBit | toBit;
-        else if (blackKing & fromBit) blackKing ^= fromBit | toBit;
+__attribute__((target("avx2"))) void addRowAvx2(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i* target = (__m256i*)(accumulator + i);
+        _mm256_store_si256(target, _mm256_add_epi16(_mm256_load_si256(target), _mm256_load_si256((const __m256i*)(row + i))));
     }
-
-    return true;
 }
 
+__attribute__((target("avx2"))) void subRowAvx2(int16_t* accumulator, const int16_t* row) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i* target = (__m256i*)(accumulator + i);
+        _mm256_store_si256(target, _mm256_sub_epi16(_mm256_load_si256(target), _mm256_load_si256((const __m256i*)(row + i))));
+    }
+}
 
-// Evaluate the current position
-int evaluatePosition() {
-    // Piece values
-    const int PAWN_VALUE = 100;
-    const int KNIGHT_VALUE = 320;
-    const int BISHOP_VALUE = 330;
-    const int ROOK_VALUE = 500;
-    const int QUEEN_VALUE = 900;
-    const int KING_VALUE = 20000;
+__attribute__((target("avx2"))) int32_t outputAvx2(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const __m256i zero = _mm256_setzero_si256(), qa = _mm256_set1_epi16(NNUE_QA);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i ourValues = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i*)(us + i)), zero), qa);
+        __m256i theirValues = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i*)(them + i)), zero), qa);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(ourValues, _mm256_load_si256((const __m256i*)(weights + i))));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(theirValues, _mm256_load_si256((const __m256i*)(weights + NNUE_HIDDEN + i))));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+#endif
+
+NnueKernels nnueKernels = {addRowScalar, subRowScalar, outputScalar};
+NnueBackend nnueBackend = NNUE_SCALAR;
+
+bool cpuSupportsNnueBackend(NnueBackend backend) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (backend == NNUE_AVX2) return __builtin_cpu_supports("avx2");
+    if (backend == NNUE_SSE41) return __builtin_cpu_supports("sse4.1");
+#endif
+    return backend == NNUE_SCALAR;
+}
 
-    // Positional bonuses
-    const int CENTER_CONTROL = 20; // Bonus for controlling central squares
-    const uint64_t CENTER_MASK = 0x0000001818000000ULL;
+void selectNnueBackend(NnueBackend backend) {
+    nnueBackend = backend;
+    nnueKernels = {addRowScalar, subRowScalar, outputScalar};
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    if (backend == NNUE_AVX2) nnueKernels = {addRowAvx2, subRowAvx2, outputAvx2};
+    else if (backend == NNUE_SSE41) nnueKernels = {addRowSse41, subRowSse41, outputSse41};
+#endif
+}
 
-    // Calculate material score
-    int whiteScore = __builtin_popcountll(whitePawns) * PAWN_VALUE +
-                     __builtin_popcountll(whiteKnights) * KNIGHT_VALUE +
-                     __builtin_popcountll(whiteBishops) * BISHOP_VALUE +
-                     __builtin_popcountll(whiteRooks) * ROOK_VALUE +
-                     __builtin_popcountll(whiteQueens) * QUEEN_VALUE +
-                     __builtin_popcountll(whiteKing) * KING_VALUE;
+// Fastest backend this CPU can run
+NnueBackend bestNnueBackend() {
+    if (cpuSupportsNnueBackend(NNUE_AVX2)) return NNUE_AVX2;
+    if (cpuSupportsNnueBackend(NNUE_SSE41)) return NNUE_SSE41;
+    return NNUE_SCALAR;
+}
 
-    int blackScore = __builtin_popcountll(blackPawns) * PAWN_VALUE +
-                     __builtin_popcountll(blackKnights) * KNIGHT_VALUE +
-                     __builtin_popcountll(blackBishops) * BISHOP_VALUE +
-                     __builtin_popcountll(blackRooks) * ROOK_VALUE +
-                     __builtin_popcountll(blackQueens) * QUEEN_VALUE +
-                     __builtin_popcountll(blackKing) * KING_VALUE;
+// Input feature of a piece on a square as seen by one side (0 = White): own pieces first, and Black
+// sees the board flipped so both sides share the same weights
+inline int nnueFeature(int perspective, int piece, int square) {
+    int relativeColor = (piece < 6 ? 0 : 1) ^ perspective;
+    return relativeColor * 384 + (piece % 6) * 64 + (perspective ? square ^ 56 : square);
+}
 
-    // Add bonuses for center control
-    whiteScore += __builtin_popcountll(whitePieces & CENTER_MASK) * CENTER_CONTROL;
-    blackScore += __builtin_popcountll(blackPieces & CENTER_MASK) * CENTER_CONTROL;
 
-    // Return evaluation
-    return whiteScore - blackScore;
-}
+// Castling rights bits
+enum CastlingRight : uint8_t {
+    WHITE_KINGSIDE = 1,
+    WHITE_QUEENSIDE = 2,
+    BLACK_KINGSIDE = 4,
+    BLACK_QUEENSIDE = 8
+};
 
+// What undoMove needs to take one move back; the rest follows from the move itself
+struct UndoInfo {
+    uint64_t hash;           // Zobrist hash before the move
+    Move move;
+    uint8_t movedPiece;
+    uint8_t capturedPiece;   // NO_PIECE if the move was not a capture
+    uint8_t castlingRights;  // Rights before the move
+    int8_t enPassantSquare;  // En passant square before the move, or -1
+    uint8_t halfmoveClock;   // Halfmove clock before the move
+};
 
+const int MAX_GAME_PLY = 1024;
+const int GAME_PLY_HEADROOM = 256; // Undo records kept free for a search from the current position
 
-// Define a structure to hold board state information
-struct BoardState {
-    uint64_t whitePawns, whiteKnights, whiteBishops, whiteRooks, whiteQueens, whiteKing;
-    uint64_t blackPawns, blackKnights, blackBishops, blackRooks, blackQueens, blackKing;
+// One game: the board plus the undo records of the moves played to reach it. Positions share
+// nothing, so any number of games (or search threads) can each own one
+struct Position {
+    uint64_t bitboards[12];  // One bitboard per Piece
     uint64_t whitePieces, blackPieces, allPieces;
-    uint64_t enPassantTarget;
-    bool whiteKingsideCastle, whiteQueensideCastle;
-    bool blackKingsideCastle, blackQueensideCastle;
+    uint64_t enPassantTarget; // En passant target square
+    uint64_t zobristKey;      // Kept up to date incrementally by makeMove/undoMove
+    uint64_t pawnKey;         // Zobrist hash of the pawns alone, for the pawn hash table
+    uint8_t board[64];        // Piece on each square (NO_PIECE if empty), for O(1) lookups
+    int midgameScore;         // Material plus piece-square values from White's point of view, middlegame weights
+    int endgameScore;         // The same with endgame weights
+    int phase;                // Sum of PHASE_WEIGHTS over the pieces on the board
+    alignas(32) int16_t accumulators[2][NNUE_HIDDEN]; // NNUE hidden layer from White's and Black's side, if useNnue
+    uint8_t castlingRights;
+    uint8_t halfmoveClock;    // Plies since the last capture or pawn move
     bool isWhiteTurn;
+    int gamePly = 0;          // Number of undo records in use
+    UndoInfo undoStack[MAX_GAME_PLY];
+
+    uint64_t hash() const { return zobristKey; }
 };
 
 
+// Side to move as a compile-time parameter. Move generation, attack detection and make/unmake are
+// instantiated once per color, so the side-dependent shifts, ranks and masks below fold into constants
+enum Color { WHITE, BLACK };
 
-void cachePosition(uint64_t zobristHash, int evaluation, int depth) {
-    transpositionTable[zobristHash] = make_pair(depth, evaluation);
-}
+template <Color Us> constexpr Color THEM = Us == WHITE ? BLACK : WHITE;
+template <Color Us> constexpr int OWN_PIECES = Us == WHITE ? WHITE_PAWN : BLACK_PAWN; // Add a piece type
+template <Color Us> constexpr int FORWARD = Us == WHITE ? 8 : -8;
+template <Color Us> constexpr int CAPTURE_WEST = Us == WHITE ? 7 : -9; // Pawn capture toward the a-file
+template <Color Us> constexpr int CAPTURE_EAST = Us == WHITE ? 9 : -7; // Pawn capture toward the h-file
+template <Color Us> constexpr uint64_t DOUBLE_PUSH_RANK = Us == WHITE ? RANK_2 << 8 : RANK_7 >> 8; // After one step
+template <Color Us> constexpr uint64_t PROMOTION_RANK = Us == WHITE ? RANK_8 : RANK_1;
+template <Color Us> constexpr uint64_t KINGSIDE_PATH = Us == WHITE ? 0x60ULL : 0x6000000000000000ULL;
+template <Color Us> constexpr uint64_t QUEENSIDE_PATH = Us == WHITE ? 0xEULL : 0xE00000000000000ULL;
+template <Color Us> constexpr uint8_t KINGSIDE_RIGHT = Us == WHITE ? WHITE_KINGSIDE : BLACK_KINGSIDE;
+template <Color Us> constexpr uint8_t QUEENSIDE_RIGHT = Us == WHITE ? WHITE_QUEENSIDE : BLACK_QUEENSIDE;
 
-int lookupTransposition(uint64_t zobristHash) {
-    if (transpositionTable.count(zobristHash)) {
-        return transpositionTable[zobristHash].second; // Return the evaluation part
-    }
-    return std::numeric_limits<int>::min();
-}
+// Shift a bitboard by a signed square offset
+template <int Step> constexpr uint64_t shift(uint64_t bits) { return Step > 0 ? bits << Step : bits >> -Step; }
 
+template <Color Us> inline uint64_t& ownOccupancy(Position& pos) { return Us == WHITE ? pos.whitePieces : pos.blackPieces; }
+template <Color Us> inline uint64_t ownOccupancy(const Position& pos) { return Us == WHITE ? pos.whitePieces : pos.blackPieces; }
 
-// Stack to store previous board states
-std::stack<BoardState> historyStack;
 
-// Function to save the current board state before making a move
-void saveBoardState(bool isWhiteTurn) {
-    BoardState currentState = {
-        whitePawns, whiteKnights, whiteBishops, whiteRooks, whiteQueens, whiteKing,
-        blackPawns, blackKnights, blackBishops, blackRooks, blackQueens, blackKing,
-        whitePieces, blackPieces, allPieces,
-        enPassantTarget,
-        whiteKingsideCastle, whiteQueensideCastle,
-        blackKingsideCastle, blackQueensideCastle,
-        isWhiteTurn // Capture the turn information
-    };
-    historyStack.push(currentState);
+// Squares attacked by every knight, king or pawn in a set
+inline uint64_t knightAttacks(uint64_t knights) {
+    return ((knights << 17) & ~FILE_A) | ((knights << 15) & ~FILE_H) |
+           ((knights << 10) & ~(FILE_A | FILE_B)) | ((knights << 6) & ~(FILE_G | FILE_H)) |
+           ((knights >> 17) & ~FILE_H) | ((knights >> 15) & ~FILE_A) |
+           ((knights >> 10) & ~(FILE_G | FILE_H)) | ((knights >> 6) & ~(FILE_A | FILE_B));
 }
 
+inline uint64_t kingAttacks(uint64_t kings) {
+    return (kings << 8) | (kings >> 8) | ((kings & ~FILE_H) << 1) | ((kings & ~FILE_A) >> 1) |
+           ((kings & ~FILE_H) << 9) | ((kings & ~FILE_A) << 7) | ((kings & ~FILE_H) >> 7) | ((kings & ~FILE_A) >> 9);
+}
 
-// Function to undo the last move by restoring the previous board state
-void undoMove() {
-    if (!historyStack.empty()) {
-        BoardState lastState = historyStack.top();
-        historyStack.pop();
-
-        // Restore board pieces and other state information
-        whitePawns = lastState.whitePawns;
-        whiteKnights = lastState.whiteKnights;
-        whiteBishops = lastState.whiteBishops;
-        whiteRooks = lastState.whiteRooks;
-        whiteQueens = lastState.whiteQueens;
-        whiteKing = lastState.whiteKing;
-
-        blackPawns = lastState.blackPawns;
-        blackKnights = lastState.blackKnights;
-        blackBishops = lastState.blackBishops;
-        blackRooks = lastState.blackRooks;
-        blackQueens = lastState.blackQueens;
-        blackKing = lastState.blackKing;
-
-        whitePieces = lastState.whitePieces;
-        blackPieces = lastState.blackPieces;
-        allPieces = lastState.allPieces;
+template <Color Us>
+inline uint64_t pawnAttacks(uint64_t pawns) {
+    return (shift<CAPTURE_WEST<Us>>(pawns) & ~FILE_H) | (shift<CAPTURE_EAST<Us>>(pawns) & ~FILE_A);
+}
 
-        whiteKingsideCastle = lastState.whiteKingsideCastle;
-        whiteQueensideCastle = lastState.whiteQueensideCastle;
-        blackKingsideCastle = lastState.blackKingsideCastle;
-        blackQueensideCastle = lastState.blackQueensideCastle;
+inline uint64_t pawnAttacks(uint64_t pawns, bool isWhite) {
+    return isWhite ? pawnAttacks<WHITE>(pawns) : pawnAttacks<BLACK>(pawns);
+}
 
-        enPassantTarget = lastState.enPassantTarget;
-    }
+// Pieces of color By attacking a square, with sliders blocked by the given occupancy
+template <Color By>
+inline uint64_t attackersTo(const Position& pos, int square, uint64_t occupied) {
+    const uint64_t* enemy = pos.bitboards + OWN_PIECES<By>;
+    uint64_t bit = 1ULL << square;
+    return (pawnAttacks<THEM<By>>(bit) & enemy[0]) |
+           (knightAttacks(bit) & enemy[1]) |
+           (bishopAttacks(square, occupied) & (enemy[2] | enemy[4])) |
+           (rookAttacks(square, occupied) & (enemy[3] | enemy[4])) |
+           (kingAttacks(bit) & enemy[5]);
 }
 
+inline uint64_t attackersTo(const Position& pos, int square, uint64_t occupied, bool byWhite) {
+    return byWhite ? attackersTo<WHITE>(pos, square, occupied) : attackersTo<BLACK>(pos, square, occupied);
+}
 
-// Define a function to get the maximum evaluation
-int max(int a, int b) {
-    return (a > b) ? a : b;
+// Whether a square (given as a one-bit bitboard) is attacked by the given color
+template <Color By>
+inline bool isSquareAttacked(const Position& pos, uint64_t square) {
+    return attackersTo<By>(pos, __builtin_ctzll(square), pos.allPieces) != 0;
 }
 
-// Define a function to get the minimum evaluation
-int min(int a, int b) {
-    return (a < b) ? a : b;
+bool isSquareAttacked(const Position& pos, uint64_t square, bool byWhite) {
+    return byWhite ? isSquareAttacked<WHITE>(pos, square) : isSquareAttacked<BLACK>(pos, square);
 }
-bool isCapture(uint64_t move, bool isWhiteTurn) {
-    uint64_t targetSquare = move; // Assume `move` encodes the target square
-    uint64_t opponentPieces = isWhiteTurn ? blackPieces : whitePieces;
-    return targetSquare & opponentPieces;
+
+// Whether the side to move is in check
+bool isInCheck(const Position& pos) {
+    return pos.isWhiteTurn ? isSquareAttacked<BLACK>(pos, pos.bitboards[WHITE_KING])
+                           : isSquareAttacked<WHITE>(pos, pos.bitboards[BLACK_KING]);
 }
 
-bool isCheck(uint64_t move, bool isWhiteTurn) {
-    saveBoardState(isWhiteTurn);
-    makeMove(move, move, isWhiteTurn);
+// Piece-square tables (PeSTO values), from White's side with a8 first: a white piece on square s reads
+// entry s ^ 56 and a black piece reads entry s. Material is added on top
+const int MIDGAME_PIECE_VALUES[6] = {82, 337, 365, 477, 1025, 0};
+const int ENDGAME_PIECE_VALUES[6] = {94, 281, 297, 512, 936, 0};
+
+const int MIDGAME_PST[6][64] = {
+    { // Pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+         98, 134,  61,  95,  68, 126,  34, -11,
+         -6,   7,  26,  31,  65,  56,  25, -20,
+        -14,  13,   6,  21,  23,  12,  17, -23,
+        -27,  -2,  -5,  12,  17,   6,  10, -25,
+        -26,  -4,  -4, -10,   3,   3,  33, -12,
+        -35,  -1, -20, -23, -15,  24,  38, -22,
+          0,   0,   0,   0,   0,   0,   0,   0},
+    { // Knight
+        -167, -89, -34, -49,  61, -97, -15, -107,
+         -73, -41,  72,  36,  23,  62,   7,  -17,
+         -47,  60,  37,  65,  84, 129,  73,   44,
+          -9,  17,  19,  53,  37,  69,  18,   22,
+         -13,   4,  16,  13,  28,  19,  21,   -8,
+         -23,  -9,  12,  10,  19,  17,  25,  -16,
+         -29, -53, -12,  -3,  -1,  18, -14,  -19,
+        -105, -21, -58, -33, -17, -28, -19,  -23},
+    { // Bishop
+        -29,   4, -82, -37, -25, -42,   7,  -8,
+        -26,  16, -18, -13,  30,  59,  18, -47,
+        -16,  37,  43,  40,  35,  50,  37,  -2,
+         -4,   5,  19,  50,  37,  37,   7,  -2,
+         -6,  13,  13,  26,  34,  12,  10,   4,
+          0,  15,  15,  15,  14,  27,  18,  10,
+          4,  15,  16,   0,   7,  21,  33,   1,
+        -33,  -3, -14, -21, -13, -12, -39, -21},
+    { // Rook
+         32,  42,  32,  51,  63,   9,  31,  43,
+         27,  32,  58,  62,  80,  67,  26,  44,
+         -5,  19,  26,  36,  17,  45,  61,  16,
+        -24, -11,   7,  26,  24,  35,  -8, -20,
+        -36, -26, -12,  -1,   9,  -7,   6, -23,
+        -45, -25, -16, -17,   3,   0,  -5, -33,
+        -44, -16, -20,  -9,  -1,  11,  -6, -71,
+        -19, -13,   1,  17,  16,   7, -37, -26},
+    { // Queen
+        -28,   0,  29,  12,  59,  44,  43,  45,
+        -24, -39,  -5,   1, -16,  57,  28,  54,
+        -13, -17,   7,   8,  29,  56,  47,  57,
+        -27, -27, -16, -16,  -1,  17,  -2,   1,
+         -9, -26,  -9, -10,  -2,  -4,   3,  -3,
+        -14,   2, -11,  -2,  -5,   2,  14,   5,
+        -35,  -8,  11,   2,   8,  15,  -3,   1,
+         -1, -18,  -9,  10, -15, -25, -31, -50},
+    { // King
+        -65,  23,  16, -15, -56, -34,   2,  13,
+         29,  -1, -20,  -7,  -8,  -4, -38, -29,
+         -9,  24,   2, -16, -20,   6,  22, -22,
+        -17, -20, -12, -27, -30, -25, -14, -36,
+        -49,  -1, -27, -39, -46, -44, -33, -51,
+        -14, -14, -22, -46, -44, -30, -15, -27,
+          1,   7,  -8, -64, -43, -16,   9,   8,
+        -15,  36,  12, -54,   8, -28,  24,  14}
+};
 
-    uint64_t king = isWhiteTurn ? blackKing : whiteKing;
-    bool result = isSquareAttacked(king, !isWhiteTurn);
+const int ENDGAME_PST[6][64] = {
+    { // Pawn
+          0,   0,   0,   0,   0,   0,   0,   0,
+        178, 173, 158, 134, 147, 132, 165, 187,
+         94, 100,  85,  67,  56,  53,  82,  84,
+         32,  24,  13,   5,  -2,   4,  17,  17,
+         13,   9,  -3,  -7,  -7,  -8,   3,  -1,
+          4,   7,  -6,   1,   0,  -5,  -1,  -8,
+         13,   8,   8,  10,  13,   0,   2,  -7,
+          0,   0,   0,   0,   0,   0,   0,   0},
+    { // Knight
+        -58, -38, -13, -28, -31, -27, -63, -99,
+        -25,  -8, -25,  -2,  -9, -25, -24, -52,
+        -24, -20,  10,   9,  -1,  -9, -19, -41,
+        -17,   3,  22,  22,  22,  11,   8, -18,
+        -18,  -6,  16,  25,  16,  17,   4, -18,
+        -23,  -3,  -1,  15,  10,  -3, -20, -22,
+        -42, -20, -10,  -5,  -2, -20, -23, -44,
+        -29, -51, -23, -15, -22, -18, -50, -64},
+    { // Bishop
+        -14, -21, -11,  -8,  -7,  -9, -17, -24,
+         -8,  -4,   7, -12,  -3, -13,  -4, -14,
+          2,  -8,   0,  -1,  -2,   6,   0,   4,
+         -3,   9,  12,   9,  14,  10,   3,   2,
+         -6,   3,  13,  19,   7,  10,  -3,  -9,
+        -12,  -3,   8,  10,  13,   3,  -7, -15,
+        -14, -18,  -7,  -1,   4,  -9, -15, -27,
+        -23,  -9, -23,  -5,  -9, -16,  -5, -17},
+    { // Rook
+         13,  10,  18,  15,  12,  12,   8,   5,
+         11,  13,  13,  11,  -3,   3,   8,   3,
+          7,   7,   7,   5,   4,  -3,  -5,  -3,
+          4,   3,  13,   1,   2,   1,  -1,   2,
+          3,   5,   8,   4,  -5,  -6,  -8, -11,
+         -4,   0,  -5,  -1,  -7, -12,  -8, -16,
+         -6,  -6,   0,   2,  -9,  -9, -11,  -3,
+         -9,   2,   3,  -1,  -5, -13,   4, -20},
+    { // Queen
+         -9,  22,  22,  27,  27,  19,  10,  20,
+        -17,  20,  32,  41,  58,  25,  30,   0,
+        -20,   6,   9,  49,  47,  35,  19,   9,
+          3,  22,  24,  45,  57,  40,  57,  36,
+        -18,  28,  19,  47,  31,  34,  39,  23,
+        -16, -27,  15,   6,   9,  17,  10,   5,
+        -22, -23, -30, -16, -16, -23, -36, -32,
+        -33, -28, -22, -43,  -5, -32, -20, -41},
+    { // King
+        -74, -35, -18, -18, -11,  15,   4, -17,
+        -12,  17,  14,  17,  17,  38,  23,  11,
+         10,  17,  23,  15,  20,  45,  44,  13,
+         -8,  22,  24,  27,  26,  33,  26,   3,
+        -18,  -4,  21,  24,  27,  23,   9, -11,
+        -19,  -3,  11,  21,  23,  16,   7,  -9,
+        -27, -11,   4,  13,  14,   4,  -5, -17,
+        -53, -34, -21, -11, -28, -14, -24, -43}
+};
 
-    undoMove(); // Revert to the original state
-    return result;
-}
+// Game phase weight of each piece type; 24 with all minor and major pieces on the board
+const int PHASE_WEIGHTS[6] = {0, 1, 1, 2, 4, 0};
+const int MAX_PHASE = 24;
 
-int movePriority(uint64_t move, bool isWhiteTurn) {
-    int priority = 0;
-    if (isCapture(move, isWhiteTurn)) {
-        priority += 100; // High priority for captures
-    }
-    if (isCheck(move, isWhiteTurn)) {
-        priority += 50; // Moderate priority for checks
+// Material plus piece-square value of each Piece on each square, from White's point of view
+int midgameTable[12][64];
+int endgameTable[12][64];
+
+void initializeEvaluation() {
+    for (int type = 0; type < 6; ++type) {
+        for (int square = 0; square < 64; ++square) {
+            midgameTable[WHITE_PAWN + type][square] = MIDGAME_PIECE_VALUES[type] + MIDGAME_PST[type][square ^ 56];
+            endgameTable[WHITE_PAWN + type][square] = ENDGAME_PIECE_VALUES[type] + ENDGAME_PST[type][square ^ 56];
+            midgameTable[BLACK_PAWN + type][square] = -MIDGAME_PIECE_VALUES[type] - MIDGAME_PST[type][square];
+            endgameTable[BLACK_PAWN + type][square] = -ENDGAME_PIECE_VALUES[type] - ENDGAME_PST[type][square];
+        }
     }
-    return priority;
 }
 
-// Recursive minimax function with alpha-beta pruning
-int minimax(int depth, bool isMaximizingPlayer, int alpha, int beta, bool isWhiteTurn) {
-    uint64_t zobristHash = zobristHistory.top(); // Retrieve current Zobrist hash
+// Piece standing on a square, or NO_PIECE
+inline int pieceOn(const Position& pos, int square) {
+    return pos.board[square];
+}
 
-    // Check transposition table
-    if (transpositionTable.count(zobristHash)) {
-        auto [storedDepth, storedEval] = transpositionTable[zobristHash];
-        if (storedDepth >= depth) {
-            return storedEval; // Use cached evaluation
-        }
+// Piece placement helpers: keep the piece bitboards, occupancy, mailbox and evaluation sums in step.
+// The color template selects the occupancy set at compile time; the untemplated forms look it up
+template <Color C>
+inline void putPiece(Position& pos, int piece, int square) {
+    uint64_t bit = 1ULL << square;
+    pos.bitboards[piece] |= bit;
+    ownOccupancy<C>(pos) |= bit;
+    pos.allPieces |= bit;
+    pos.board[square] = (uint8_t)piece;
+    if (piece == OWN_PIECES<C>) pos.pawnKey ^= zobristTable[piece][square];
+    pos.midgameScore += midgameTable[piece][square];
+    pos.endgameScore += endgameTable[piece][square];
+    pos.phase += PHASE_WEIGHTS[piece - OWN_PIECES<C>];
+    if (useNnue) {
+        nnueKernels.addRow(pos.accumulators[0], network.featureWeights[nnueFeature(0, piece, square)]);
+        nnueKernels.addRow(pos.accumulators[1], network.featureWeights[nnueFeature(1, piece, square)]);
     }
+}
 
-    // Base case: if depth is 0 or the game is over
-    if (depth == 0 || isCheckmateOrStalemate(isWhiteTurn)) {
-        return evaluatePosition();
+template <Color C>
+inline void removePiece(Position& pos, int piece, int square) {
+    uint64_t bit = 1ULL << square;
+    pos.bitboards[piece] ^= bit;
+    ownOccupancy<C>(pos) ^= bit;
+    pos.allPieces ^= bit;
+    pos.board[square] = NO_PIECE;
+    if (piece == OWN_PIECES<C>) pos.pawnKey ^= zobristTable[piece][square];
+    pos.midgameScore -= midgameTable[piece][square];
+    pos.endgameScore -= endgameTable[piece][square];
+    pos.phase -= PHASE_WEIGHTS[piece - OWN_PIECES<C>];
+    if (useNnue) {
+        nnueKernels.subRow(pos.accumulators[0], network.featureWeights[nnueFeature(0, piece, square)]);
+        nnueKernels.subRow(pos.accumulators[1], network.featureWeights[nnueFeature(1, piece, square)]);
     }
+}
 
-    vector<uint64_t> legalMoves;
-    int bestEval = isMaximizingPlayer ? std::numeric_limits<int>::min() : std::numeric_limits<int>::max();
-
-    // Generate all moves for the current player
-    uint64_t pieces = isWhiteTurn ? whitePieces : blackPieces;
-    while (pieces) {
-        uint64_t piece = pieces & -pieces; // Isolate least significant bit
-        pieces &= pieces - 1;
-
-        if (isWhiteTurn) {
-            if (whitePawns & piece) legalMoves = generatePawnMoves(piece, true);
-            else if (whiteKnights & piece) legalMoves = generateKnightMoves(piece, true);
-            else if (whiteBishops & piece) legalMoves = generateBishopMoves(piece, true);
-            else if (whiteRooks & piece) legalMoves = generateRookMoves(piece, true);
-            else if (whiteQueens & piece) legalMoves = generateQueenMoves(piece, true);
-            else if (whiteKing & piece) legalMoves = generateKingMoves(piece, true);
-        } else {
-            if (blackPawns & piece) legalMoves = generatePawnMoves(piece, false);
-            else if (blackKnights & piece) legalMoves = generateKnightMoves(piece, false);
-            else if (blackBishops & piece) legalMoves = generateBishopMoves(piece, false);
-            else if (blackRooks & piece) legalMoves = generateRookMoves(piece, false);
-            else if (blackQueens & piece) legalMoves = generateQueenMoves(piece, false);
-            else if (blackKing & piece) legalMoves = generateKingMoves(piece, false);
+template <Color C>
+inline void movePiece(Position& pos, int piece, int from, int to) {
+    uint64_t bits = (1ULL << from) | (1ULL << to);
+    pos.bitboards[piece] ^= bits;
+    ownOccupancy<C>(pos) ^= bits;
+    pos.allPieces ^= bits;
+    pos.board[from] = NO_PIECE;
+    pos.board[to] = (uint8_t)piece;
+    if (piece == OWN_PIECES<C>) pos.pawnKey ^= zobristTable[piece][from] ^ zobristTable[piece][to];
+    pos.midgameScore += midgameTable[piece][to] - midgameTable[piece][from];
+    pos.endgameScore += endgameTable[piece][to] - endgameTable[piece][from];
+    if (useNnue) {
+        for (int perspective = 0; perspective < 2; ++perspective) {
+            nnueKernels.subRow(pos.accumulators[perspective], network.featureWeights[nnueFeature(perspective, piece, from)]);
+            nnueKernels.addRow(pos.accumulators[perspective], network.featureWeights[nnueFeature(perspective, piece, to)]);
         }
+    }
+}
 
-        // Move ordering: prioritize captures or checks
-        sort(legalMoves.begin(), legalMoves.end(), [isWhiteTurn](uint64_t a, uint64_t b) {
-            return movePriority(a, isWhiteTurn) > movePriority(b, isWhiteTurn);
-        });
-
-
-        for (uint64_t move : legalMoves) {
-            if (!isMoveLegal(piece, move, isWhiteTurn)) continue;
+inline void putPiece(Position& pos, int piece, int square) {
+    piece < BLACK_PAWN ? putPiece<WHITE>(pos, piece, square) : putPiece<BLACK>(pos, piece, square);
+}
 
-            saveBoardState(isWhiteTurn);
-            makeMove(piece, move, isWhiteTurn);
+inline void removePiece(Position& pos, int piece, int square) {
+    piece < BLACK_PAWN ? removePiece<WHITE>(pos, piece, square) : removePiece<BLACK>(pos, piece, square);
+}
 
-            int eval;
-            if (isMaximizingPlayer) {
-                eval = minimax(depth - 1, false, alpha, beta, !isWhiteTurn);
-                bestEval = max(bestEval, eval);
-                alpha = max(alpha, eval);
-            } else {
-                eval = minimax(depth - 1, true, alpha, beta, !isWhiteTurn);
-                bestEval = min(bestEval, eval);
-                beta = min(beta, eval);
-            }
+inline void movePiece(Position& pos, int piece, int from, int to) {
+    piece < BLACK_PAWN ? movePiece<WHITE>(pos, piece, from, to) : movePiece<BLACK>(pos, piece, from, to);
+}
 
-            undoMove();
+// Zobrist keys for the current castling rights and en passant square
+uint64_t castlingAndEnPassantHash(const Position& pos) {
+    uint64_t hash = 0;
+    for (int right = 0; right < 4; ++right) {
+        if (pos.castlingRights & (1 << right)) hash ^= zobristCastlingKeys[right];
+    }
+    if (pos.enPassantTarget) hash ^= zobristEnPassantKeys[__builtin_ctzll(pos.enPassantTarget) % 8];
+    return hash;
+}
 
-            if (beta <= alpha) {
-                break; // Alpha-beta cutoff
-            }
+// Compute the hash of the current position from scratch (makeMove keeps it up to date incrementally)
+uint64_t computeZobristHash(const Position& pos) {
+    uint64_t hash = castlingAndEnPassantHash(pos);
+    for (int piece = 0; piece < 12; ++piece) {
+        uint64_t pieces = pos.bitboards[piece];
+        while (pieces) {
+            hash ^= zobristTable[piece][__builtin_ctzll(pieces)];
+            pieces &= pieces - 1;
         }
     }
+    if (!pos.isWhiteTurn) hash ^= zobristSideKey;
+    return hash;
+}
 
-    // Store result in transposition table
-    transpositionTable[zobristHash] = make_pair(depth, bestEval);
-
+// Rebuild occupancy and the mailbox from the piece bitboards, forget the move history and hash the board as the new root
+void resetHistory(Position& pos) {
+    uint64_t pieces[12];
+    copy(begin(pos.bitboards), end(pos.bitboards), pieces);
+    fill(begin(pos.bitboards), end(pos.bitboards), 0);
+    fill(begin(pos.board), end(pos.board), (uint8_t)NO_PIECE);
+    pos.whitePieces = pos.blackPieces = pos.allPieces = 0;
+    pos.midgameScore = pos.endgameScore = pos.phase = 0;
+    pos.pawnKey = 0;
+    for (auto& accumulator : pos.accumulators) copy(begin(network.featureBias), end(network.featureBias), accumulator);
+    for (int piece = 0; piece < 12; ++piece) {
+        for (uint64_t bits = pieces[piece]; bits; bits &= bits - 1) {
+            putPiece(pos, piece, __builtin_ctzll(bits));
+        }
+    }
 
-    return bestEval;
+    pos.gamePly = 0;
+    pos.zobristKey = computeZobristHash(pos);
 }
 
-struct Move {
-    uint64_t from;
-    uint64_t to;
-    int evaluation;
-};
-
-// Function to find the best move for the computer
-Move findBestMove(bool isWhiteTurn, int depth = 4) {
-    Move bestMove = {0, 0, isWhiteTurn ? std::numeric_limits<int>::min() : std::numeric_limits<int>::max()};
-    uint64_t pieces = isWhiteTurn ? whitePieces : blackPieces;
+// Initialize board position
+void initializePosition(Position& pos) {
+    uint64_t* b = pos.bitboards;
+    b[WHITE_PAWN] = 0x000000000000FF00ULL;
+    b[WHITE_KNIGHT] = 0x0000000000000042ULL;
+    b[WHITE_BISHOP] = 0x0000000000000024ULL;
+    b[WHITE_ROOK] = 0x0000000000000081ULL;
+    b[WHITE_QUEEN] = 0x0000000000000008ULL;
+    b[WHITE_KING] = 0x0000000000000010ULL;
+
+    b[BLACK_PAWN] = 0x00FF000000000000ULL;
+    b[BLACK_KNIGHT] = 0x4200000000000000ULL;
+    b[BLACK_BISHOP] = 0x2400000000000000ULL;
+    b[BLACK_ROOK] = 0x8100000000000000ULL;
+    b[BLACK_QUEEN] = 0x0800000000000000ULL;
+    b[BLACK_KING] = 0x1000000000000000ULL;
+
+    pos.castlingRights = WHITE_KINGSIDE | WHITE_QUEENSIDE | BLACK_KINGSIDE | BLACK_QUEENSIDE;
+    pos.enPassantTarget = 0;
+    pos.halfmoveClock = 0;
+    pos.isWhiteTurn = true;
 
-    while (pieces) {
-        uint64_t piece = pieces & -pieces;
-        pieces &= pieces - 1;
+    // Initialize Zobrist hash for the initial position
+    resetHistory(pos);
+}
 
-        vector<uint64_t> legalMoves;
-        if (isWhiteTurn) {
-            if (whitePawns & piece) legalMoves = generatePawnMoves(piece, true);
-            else if (whiteKnights & piece) legalMoves = generateKnightMoves(piece, true);
-            else if (whiteBishops & piece) legalMoves = generateBishopMoves(piece, true);
-            else if (whiteRooks & piece) legalMoves = generateRookMoves(piece, true);
-            else if (whiteQueens & piece) legalMoves = generateQueenMoves(piece, true);
-            else if (whiteKing & piece) legalMoves = generateKingMoves(piece, true);
+// Set up the board from a FEN string. Returns false, leaving pos unchanged, for a malformed FEN or an
+// impossible position: not exactly one king a side, pawns on the first or last rank, the side not to move
+// in check, or an en passant square with no pawn that could have just passed it. Castling rights whose
+// king or rook is not on its home square are dropped
+bool setPositionFromFEN(Position& pos, const string& fen) {
+    istringstream fields(fen);
+    string placement, side = "w", castling = "-", enPassant = "-";
+    int halfmoveClock = 0;
+    fields >> placement >> side >> castling >> enPassant >> halfmoveClock;
+
+    uint64_t pieces[12] = {};
+    int rank = 7, file = 0;
+    for (char c : placement) {
+        if (c == '/') {
+            if (file != 8 || rank == 0) return false;
+            rank--;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > 8) return false;
         } else {
-            if (blackPawns & piece) legalMoves = generatePawnMoves(piece, false);
-            else if (blackKnights & piece) legalMoves = generateKnightMoves(piece, false);
-            else if (blackBishops & piece) legalMoves = generateBishopMoves(piece, false);
-            else if (blackRooks & piece) legalMoves = generateRookMoves(piece, false);
-            else if (blackQueens & piece) legalMoves = generateQueenMoves(piece, false);
-            else if (blackKing & piece) legalMoves = generateKingMoves(piece, false);
+            size_t piece = string("PNBRQKpnbrqk").find(c);
+            if (piece == string::npos || file > 7) return false;
+            pieces[piece] |= 1ULL << (rank * 8 + file);
+            file++;
         }
+    }
+    if (rank != 0 || file != 8) return false;
+    if (__builtin_popcountll(pieces[WHITE_KING]) != 1 || __builtin_popcountll(pieces[BLACK_KING]) != 1) return false;
+    if ((pieces[WHITE_PAWN] | pieces[BLACK_PAWN]) & (RANK_1 | RANK_8)) return false;
+    if (side != "w" && side != "b") return false;
+    if (castling != "-" && castling.find_first_not_of("KQkq") != string::npos) return false;
+    bool isWhiteTurn = side == "w";
+
+    uint64_t enPassantTarget = 0;
+    if (enPassant != "-") {
+        if (enPassant.size() != 2 || enPassant[0] < 'a' || enPassant[0] > 'h' || enPassant[1] != (isWhiteTurn ? '6' : '3')) {
+            return false;
+        }
+        enPassantTarget = 1ULL << ((enPassant[1] - '1') * 8 + (enPassant[0] - 'a'));
+        uint64_t passedPawn = isWhiteTurn ? enPassantTarget >> 8 : enPassantTarget << 8;
+        uint64_t occupied = 0;
+        for (uint64_t bits : pieces) occupied |= bits;
+        if (!(pieces[isWhiteTurn ? BLACK_PAWN : WHITE_PAWN] & passedPawn) || (occupied & enPassantTarget)) return false;
+    }
 
-        for (uint64_t move : legalMoves) {
-            if (!isMoveLegal(piece, move, isWhiteTurn)) continue;
-
-            saveBoardState(isWhiteTurn);
-            makeMove(piece, move, isWhiteTurn);
+    auto parsed = make_unique<Position>();
+    copy(begin(pieces), end(pieces), parsed->bitboards);
+    parsed->isWhiteTurn = isWhiteTurn;
+    parsed->castlingRights = 0;
+    auto grant = [&](char letter, uint8_t right, int piece, int square) {
+        if (castling.find(letter) != string::npos && ((pieces[piece] >> square) & 1)) parsed->castlingRights |= right;
+    };
+    if ((pieces[WHITE_KING] >> 4) & 1) {
+        grant('K', WHITE_KINGSIDE, WHITE_ROOK, 7);
+        grant('Q', WHITE_QUEENSIDE, WHITE_ROOK, 0);
+    }
+    if ((pieces[BLACK_KING] >> 60) & 1) {
+        grant('k', BLACK_KINGSIDE, BLACK_ROOK, 63);
+        grant('q', BLACK_QUEENSIDE, BLACK_ROOK, 56);
+    }
+    parsed->halfmoveClock = (uint8_t)min(max(halfmoveClock, 0), 255);
+    parsed->enPassantTarget = enPassantTarget;
+    resetHistory(*parsed);
 
-            int eval = minimax(depth - 1, !isWhiteTurn, std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), !isWhiteTurn);
-            undoMove();
+    // The side that just moved cannot have left its king in check
+    if (isSquareAttacked(*parsed, parsed->bitboards[isWhiteTurn ? BLACK_KING : WHITE_KING], isWhiteTurn)) return false;
+    pos = *parsed;
+    return true;
+}
 
-            cout << "Move from " << squareToNotation(piece) << " to " << squareToNotation(move)
-                 << " evaluated at " << eval << endl;
+const string START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
-            if ((isWhiteTurn && eval > bestMove.evaluation) || (!isWhiteTurn && eval < bestMove.evaluation)) {
-                bestMove = {piece, move, eval};
+// FEN of the position; the position does not track the full-move number, so the caller supplies it
+string positionToFen(const Position& pos, int fullmove = 1) {
+    string fen;
+    for (int rank = 7; rank >= 0; --rank) {
+        int empty = 0;
+        for (int file = 0; file < 8; ++file) {
+            int piece = pieceOn(pos, rank * 8 + file);
+            if (piece == NO_PIECE) {
+                empty++;
+                continue;
             }
+            if (empty) fen += (char)('0' + empty);
+            fen += "PNBRQKpnbrqk"[piece];
+            empty = 0;
         }
+        if (empty) fen += (char)('0' + empty);
+        if (rank) fen += '/';
     }
-
-    cout << "Best move selected: from " << squareToNotation(bestMove.from) << " to " << squareToNotation(bestMove.to)
-         << " with evaluation " << bestMove.evaluation << endl;
-    return bestMove;
+    string castling;
+    if (pos.castlingRights & WHITE_KINGSIDE) castling += 'K';
+    if (pos.castlingRights & WHITE_QUEENSIDE) castling += 'Q';
+    if (pos.castlingRights & BLACK_KINGSIDE) castling += 'k';
+    if (pos.castlingRights & BLACK_QUEENSIDE) castling += 'q';
+    fen += pos.isWhiteTurn ? " w " : " b ";
+    fen += castling.empty() ? "-" : castling;
+    fen += " " + (pos.enPassantTarget ? squareToNotation(pos.enPassantTarget) : string("-"));
+    return fen + " " + to_string(pos.halfmoveClock) + " " + to_string(fullmove);
+}
+
+
+// Enhanced print function to display the board for players
+void printBoardForPlayers(const Position& pos) {
+    cout << "\nCurrent Board:\n";
+    cout << "  a b c d e f g h\n +----------------+\n";
+    for (int rank = 7; rank >= 0; --rank) {
+        cout << rank + 1 << "| ";
+        for (int file = 0; file < 8; ++file) {
+            int piece = pieceOn(pos, rank * 8 + file);
+            cout << (piece == NO_PIECE ? '.' : "PNBRQKpnbrqk"[piece]) << ' ';
+        }
+        cout << "|\n";
+    }
+    cout << " +----------------+\n";
+}
+
+// Serialize a target bitboard into moves from one square
+void addMoves(int from, uint64_t targets, uint64_t enemies, MoveList& list) {
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        targets &= targets - 1;
+        list.add(encodeMove(from, to, ((enemies >> to) & 1) ? CAPTURE : QUIET));
+    }
+}
+
+// Serialize pawn targets that all share the same step
+template <int Step>
+void addPawnMoves(uint64_t targets, int flags, MoveList& list) {
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        targets &= targets - 1;
+        list.add(encodeMove(to - Step, to, flags));
+    }
+}
+
+// Same for targets on the last rank, expanding each into all four promotions
+template <int Step>
+void addPromotions(uint64_t targets, int flags, MoveList& list) {
+    while (targets) {
+        int to = __builtin_ctzll(targets);
+        targets &= targets - 1;
+        for (int promotion = KNIGHT_PROMOTION; promotion <= QUEEN_PROMOTION; ++promotion) {
+            list.add(encodeMove(to - Step, to, promotion | flags));
+        }
+    }
+}
+
+// What keeps the side to move's king safe at this node, computed once before generating moves
+struct LegalityMasks {
+    int kingSquare;
+    uint64_t checkers;  // Enemy pieces giving check
+    uint64_t checkMask; // Destinations that resolve the check (everything when not in check)
+    uint64_t pinned;    // Own pieces pinned to the king
+
+    // Destinations allowed for a non-king piece on the given square
+    uint64_t targets(int from) const {
+        return ((pinned >> from) & 1) ? checkMask & lineTable[kingSquare][from] : checkMask;
+    }
+};
+
+template <Color Us>
+LegalityMasks computeLegalityMasks(const Position& pos) {
+    LegalityMasks masks;
+    const uint64_t* enemy = pos.bitboards + OWN_PIECES<THEM<Us>>;
+    uint64_t ownPieces = ownOccupancy<Us>(pos);
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+    masks.kingSquare = __builtin_ctzll(pos.bitboards[OWN_PIECES<Us> + WHITE_KING]);
+    masks.checkers = attackersTo<THEM<Us>>(pos, masks.kingSquare, pos.allPieces);
+
+    if (masks.checkers == 0) masks.checkMask = ~0ULL;
+    else if ((masks.checkers & (masks.checkers - 1)) == 0) {
+        masks.checkMask = masks.checkers | betweenTable[masks.kingSquare][__builtin_ctzll(masks.checkers)];
+    } else masks.checkMask = 0; // Double check: only the king can move
+
+    // Enemy sliders that would see the king through exactly one of our pieces pin it
+    masks.pinned = 0;
+    uint64_t snipers = (rookAttacks(masks.kingSquare, enemies) & (enemy[3] | enemy[4])) |
+                       (bishopAttacks(masks.kingSquare, enemies) & (enemy[2] | enemy[4]));
+    while (snipers) {
+        int sniper = __builtin_ctzll(snipers);
+        snipers &= snipers - 1;
+        uint64_t blockers = betweenTable[masks.kingSquare][sniper] & pos.allPieces;
+        if (blockers && (blockers & (blockers - 1)) == 0) masks.pinned |= blockers & ownPieces;
+    }
+    return masks;
+}
+
+// Pawn pushes and captures whose destinations lie in targetMask
+template <Color Us>
+void generatePawnMoves(const Position& pos, uint64_t pawns, uint64_t targetMask, MoveList& list) {
+    constexpr int UP = FORWARD<Us>, WEST = CAPTURE_WEST<Us>, EAST = CAPTURE_EAST<Us>;
+    uint64_t empty = ~pos.allPieces;
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+
+    uint64_t singleStep = shift<UP>(pawns) & empty;
+    uint64_t doubleStep = shift<UP>(singleStep & DOUBLE_PUSH_RANK<Us>) & empty & targetMask;
+    uint64_t attacksWest = shift<WEST>(pawns) & enemies & ~FILE_H & targetMask;
+    uint64_t attacksEast = shift<EAST>(pawns) & enemies & ~FILE_A & targetMask;
+    singleStep &= targetMask;
+
+    addPawnMoves<UP>(singleStep & ~PROMOTION_RANK<Us>, QUIET, list);
+    addPawnMoves<2 * UP>(doubleStep, DOUBLE_PAWN_PUSH, list);
+    addPawnMoves<WEST>(attacksWest & ~PROMOTION_RANK<Us>, CAPTURE, list);
+    addPawnMoves<EAST>(attacksEast & ~PROMOTION_RANK<Us>, CAPTURE, list);
+    if ((singleStep | attacksWest | attacksEast) & PROMOTION_RANK<Us>) {
+        addPromotions<UP>(singleStep & PROMOTION_RANK<Us>, QUIET, list);
+        addPromotions<WEST>(attacksWest & PROMOTION_RANK<Us>, CAPTURE, list);
+        addPromotions<EAST>(attacksEast & PROMOTION_RANK<Us>, CAPTURE, list);
+    }
+}
+
+
+// Generate knight moves (a pinned knight can never move)
+template <Color Us>
+void generateKnightMoves(const Position& pos, uint64_t knights, const LegalityMasks& masks, MoveList& list) {
+    uint64_t ownPieces = ownOccupancy<Us>(pos);
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+
+    knights &= ~masks.pinned;
+    while (knights) {
+        int knight = __builtin_ctzll(knights);
+        knights &= knights - 1;
+        addMoves(knight, knightAttacks(1ULL << knight) & ~ownPieces & masks.checkMask, enemies, list);
+    }
+}
+
+
+// Generate bishop moves (diagonals)
+template <Color Us>
+void generateBishopMoves(const Position& pos, uint64_t bishops, const LegalityMasks& masks, MoveList& list) {
+    uint64_t ownPieces = ownOccupancy<Us>(pos);
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+
+    while (bishops) {
+        int bishop = __builtin_ctzll(bishops);
+        bishops &= bishops - 1;
+        addMoves(bishop, bishopAttacks(bishop, pos.allPieces) & ~ownPieces & masks.targets(bishop), enemies, list);
+    }
+}
+
+// Generate rook moves (straight lines)
+template <Color Us>
+void generateRookMoves(const Position& pos, uint64_t rooks, const LegalityMasks& masks, MoveList& list) {
+    uint64_t ownPieces = ownOccupancy<Us>(pos);
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+
+    while (rooks) {
+        int rook = __builtin_ctzll(rooks);
+        rooks &= rooks - 1;
+        addMoves(rook, rookAttacks(rook, pos.allPieces) & ~ownPieces & masks.targets(rook), enemies, list);
+    }
+}
+
+// Generate queen moves by combining rook and bishop moves
+template <Color Us>
+void generateQueenMoves(const Position& pos, uint64_t queens, const LegalityMasks& masks, MoveList& list) {
+    uint64_t ownPieces = ownOccupancy<Us>(pos);
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+
+    while (queens) {
+        int queen = __builtin_ctzll(queens);
+        queens &= queens - 1;
+        addMoves(queen, queenAttacks(queen, pos.allPieces) & ~ownPieces & masks.targets(queen), enemies, list);
+    }
+}
+
+// Castling check (the caller has already ruled out castling out of check)
+template <Color Us>
+bool canCastleKingside(const Position& pos) {
+    uint64_t kingPosition = pos.bitboards[OWN_PIECES<Us> + WHITE_KING];
+
+    // Ensure the squares between king and rook are empty, and check that the squares the king will move over are safe
+    return (pos.castlingRights & KINGSIDE_RIGHT<Us>) &&
+           !(pos.allPieces & KINGSIDE_PATH<Us>) &&
+           !isSquareAttacked<THEM<Us>>(pos, kingPosition << 1) &&
+           !isSquareAttacked<THEM<Us>>(pos, kingPosition << 2);
+}
+
+// Checks if the king can castle
+template <Color Us>
+bool canCastleQueenside(const Position& pos) {
+    uint64_t kingPosition = pos.bitboards[OWN_PIECES<Us> + WHITE_KING];
+
+    return (pos.castlingRights & QUEENSIDE_RIGHT<Us>) &&
+           !(pos.allPieces & QUEENSIDE_PATH<Us>) &&
+           !isSquareAttacked<THEM<Us>>(pos, kingPosition >> 1) &&
+           !isSquareAttacked<THEM<Us>>(pos, kingPosition >> 2);
+}
+
+// Generate king moves, including castling. Destinations are tested with the king lifted off the board,
+// so it cannot step back along the line of a slider that is checking it
+template <Color Us>
+void generateKingMoves(const Position& pos, const LegalityMasks& masks, MoveList& list) {
+    uint64_t ownPieces = ownOccupancy<Us>(pos);
+    uint64_t enemies = ownOccupancy<THEM<Us>>(pos);
+    int from = masks.kingSquare;
+    uint64_t occupied = pos.allPieces ^ (1ULL << from);
+
+    uint64_t kingMoves = kingAttacks(1ULL << from) & ~ownPieces;
+    uint64_t safe = 0;
+    for (uint64_t targets = kingMoves; targets; targets &= targets - 1) {
+        int to = __builtin_ctzll(targets);
+        if (!attackersTo<THEM<Us>>(pos, to, occupied)) safe |= 1ULL << to;
+    }
+    addMoves(from, safe, enemies, list);
+
+    if (masks.checkers) return;
+    if (canCastleKingside<Us>(pos)) list.add(encodeMove(from, from + 2, KING_CASTLE));
+    if (canCastleQueenside<Us>(pos)) list.add(encodeMove(from, from - 2, QUEEN_CASTLE));
+}
+
+// En passant move generation. Removing two pawns from one rank can expose the king sideways, and the
+// captured pawn may itself be the checker, so each capture is tested exactly on the resulting occupancy
+template <Color Us>
+void generateEnPassantMoves(const Position& pos, uint64_t pawns, const LegalityMasks& masks, MoveList& list) {
+    if (pos.enPassantTarget == 0) return;
+
+    int to = __builtin_ctzll(pos.enPassantTarget);
+    int capturedSquare = to - FORWARD<Us>;
+    uint64_t capturers = pawnAttacks<THEM<Us>>(pos.enPassantTarget) & pawns;
+    while (capturers) {
+        int from = __builtin_ctzll(capturers);
+        capturers &= capturers - 1;
+
+        uint64_t occupied = (pos.allPieces ^ (1ULL << from) ^ (1ULL << capturedSquare)) | pos.enPassantTarget;
+        if (attackersTo<THEM<Us>>(pos, masks.kingSquare, occupied) & ~(1ULL << capturedSquare)) continue;
+        list.add(encodeMove(from, to, EN_PASSANT));
+    }
+}
+
+// Generate every legal move for side Us, which must be the side to move
+template <Color Us>
+void generateMoves(const Position& pos, MoveList& list) {
+    const uint64_t* own = pos.bitboards + OWN_PIECES<Us>;
+    LegalityMasks masks = computeLegalityMasks<Us>(pos);
+    list.count = 0;
+
+    // Double check: only the king can move
+    if (masks.checkMask) {
+        generatePawnMoves<Us>(pos, own[0] & ~masks.pinned, masks.checkMask, list);
+        for (uint64_t pinnedPawns = own[0] & masks.pinned; pinnedPawns; pinnedPawns &= pinnedPawns - 1) {
+            int pawn = __builtin_ctzll(pinnedPawns);
+            generatePawnMoves<Us>(pos, 1ULL << pawn, masks.targets(pawn), list);
+        }
+        generateEnPassantMoves<Us>(pos, own[0], masks, list);
+        generateKnightMoves<Us>(pos, own[1], masks, list);
+        generateBishopMoves<Us>(pos, own[2], masks, list);
+        generateRookMoves<Us>(pos, own[3], masks, list);
+        generateQueenMoves<Us>(pos, own[4], masks, list);
+    }
+    generateKingMoves<Us>(pos, masks, list);
+}
+
+// Generate every legal move for the side to move, choosing the color specialization once
+void generateMoves(const Position& pos, MoveList& list) {
+    if (pos.isWhiteTurn) generateMoves<WHITE>(pos, list);
+    else generateMoves<BLACK>(pos, list);
+    LOG(LOG_TRACE, LOG_MOVEGEN, list.size() << " moves in " << hex << pos.hash());
+}
+
+
+
+// Parse move input like "e2 e4" to bitboard squares
+pair<int, int> parseInput(const string& input) {
+    int fileFrom = input[0] - 'a';
+    int rankFrom = input[1] - '1';
+    int fileTo = input[3] - 'a';
+    int rankTo = input[4] - '1';
+
+    int fromSquare = rankFrom * 8 + fileFrom;
+    int toSquare = rankTo * 8 + fileTo;
+    return {fromSquare, toSquare};
+}
+
+
+#ifdef CHESS_DEBUG_CHECKS
+// Mailbox and occupancy agree with the piece bitboards
+bool boardIsConsistent(const Position& pos) {
+    uint64_t white = 0, black = 0;
+    for (int piece = 0; piece < 12; ++piece) {
+        (piece < BLACK_PAWN ? white : black) |= pos.bitboards[piece];
+    }
+    if (white != pos.whitePieces || black != pos.blackPieces || (white | black) != pos.allPieces) return false;
+    for (int square = 0; square < 64; ++square) {
+        int piece = pos.board[square];
+        if (piece == NO_PIECE ? ((pos.allPieces >> square) & 1) : !((pos.bitboards[piece] >> square) & 1)) return false;
+    }
+    return true;
+}
+
+// The incrementally updated evaluation sums and pawn key match a from-scratch recompute
+bool evaluationIsConsistent(const Position& pos) {
+    int midgame = 0, endgame = 0, phase = 0;
+    uint64_t pawnKey = 0;
+    for (int square = 0; square < 64; ++square) {
+        int piece = pos.board[square];
+        if (piece == NO_PIECE) continue;
+        if (piece % 6 == WHITE_PAWN) pawnKey ^= zobristTable[piece][square];
+        midgame += midgameTable[piece][square];
+        endgame += endgameTable[piece][square];
+        phase += PHASE_WEIGHTS[piece % 6];
+    }
+    if (midgame != pos.midgameScore || endgame != pos.endgameScore || phase != pos.phase) return false;
+    if (pawnKey != pos.pawnKey) return false;
+
+    if (!useNnue) return true;
+    for (int perspective = 0; perspective < 2; ++perspective) {
+        int16_t accumulator[NNUE_HIDDEN];
+        copy(begin(network.featureBias), end(network.featureBias), accumulator);
+        for (int square = 0; square < 64; ++square) {
+            if (pos.board[square] != NO_PIECE) addRowScalar(accumulator, network.featureWeights[nnueFeature(perspective, pos.board[square], square)]);
+        }
+        if (!equal(begin(accumulator), end(accumulator), pos.accumulators[perspective])) return false;
+    }
+    return true;
+}
+#endif
+
+// Castling rights kept when a piece moves from or to each square (king and rook home squares clear rights)
+uint8_t castlingRightsMask(int square) {
+    switch (square) {
+        case 0: return (uint8_t)~WHITE_QUEENSIDE;
+        case 4: return (uint8_t)~(WHITE_KINGSIDE | WHITE_QUEENSIDE);
+        case 7: return (uint8_t)~WHITE_KINGSIDE;
+        case 56: return (uint8_t)~BLACK_QUEENSIDE;
+        case 60: return (uint8_t)~(BLACK_KINGSIDE | BLACK_QUEENSIDE);
+        case 63: return (uint8_t)~BLACK_KINGSIDE;
+        default: return 0xFF;
+    }
+}
+
+// Rook squares for a castling move, given the king's destination square
+inline int castlingRookFrom(int flags, int kingTo) { return flags == KING_CASTLE ? kingTo + 1 : kingTo - 2; }
+inline int castlingRookTo(int flags, int kingTo) { return flags == KING_CASTLE ? kingTo - 1 : kingTo + 1; }
+
+// Apply a legal move from generateMoves for side Us, which must be the side to move. Only a small undo
+// record is saved, so every call must be paired with undoMove
+template <Color Us>
+void makeMove(Position& pos, Move move) {
+    assert(pos.gamePly < MAX_GAME_PLY);
+    UndoInfo& undo = pos.undoStack[pos.gamePly++];
+
+    int fromSquare = moveFrom(move);
+    int toSquare = moveTo(move);
+    int flags = moveFlags(move);
+    int piece = pieceOn(pos, fromSquare);
+    int captured = flags == EN_PASSANT ? OWN_PIECES<THEM<Us>>
+                                       : ((flags & CAPTURE) ? pieceOn(pos, toSquare) : NO_PIECE);
+
+    undo.hash = pos.zobristKey;
+    undo.move = move;
+    undo.movedPiece = (uint8_t)piece;
+    undo.capturedPiece = (uint8_t)captured;
+    undo.castlingRights = pos.castlingRights;
+    undo.enPassantSquare = pos.enPassantTarget ? (int8_t)__builtin_ctzll(pos.enPassantTarget) : -1;
+    undo.halfmoveClock = pos.halfmoveClock;
+
+    uint64_t hash = pos.zobristKey ^ castlingAndEnPassantHash(pos) ^ zobristSideKey;
+
+    // Remove the captured piece
+    if (captured != NO_PIECE) {
+        int capturedSquare = flags == EN_PASSANT ? toSquare - FORWARD<Us> : toSquare;
+        removePiece<THEM<Us>>(pos, captured, capturedSquare);
+        hash ^= zobristTable[captured][capturedSquare];
+    }
+
+    // Move the piece, swapping in the promoted piece if needed
+    hash ^= zobristTable[piece][fromSquare];
+    if (flags & 8) {
+        int promoted = OWN_PIECES<Us> + WHITE_KNIGHT + (flags & 3);
+        removePiece<Us>(pos, piece, fromSquare);
+        putPiece<Us>(pos, promoted, toSquare);
+        hash ^= zobristTable[promoted][toSquare];
+    } else {
+        movePiece<Us>(pos, piece, fromSquare, toSquare);
+        hash ^= zobristTable[piece][toSquare];
+    }
+
+    // Castling also moves the rook
+    if (flags == KING_CASTLE || flags == QUEEN_CASTLE) {
+        constexpr int rook = OWN_PIECES<Us> + WHITE_ROOK;
+        int rookFrom = castlingRookFrom(flags, toSquare);
+        int rookTo = castlingRookTo(flags, toSquare);
+        movePiece<Us>(pos, rook, rookFrom, rookTo);
+        hash ^= zobristTable[rook][rookFrom] ^ zobristTable[rook][rookTo];
+    }
+
+    pos.castlingRights &= castlingRightsMask(fromSquare) & castlingRightsMask(toSquare);
+    pos.enPassantTarget = (flags == DOUBLE_PAWN_PUSH) ? 1ULL << ((fromSquare + toSquare) / 2) : 0;
+    pos.halfmoveClock = (captured != NO_PIECE || piece == OWN_PIECES<Us>)
+                            ? 0 : (uint8_t)min(pos.halfmoveClock + 1, 255);
+    pos.isWhiteTurn = Us == BLACK;
+
+    pos.zobristKey = hash ^ castlingAndEnPassantHash(pos);
+#ifdef CHESS_DEBUG_CHECKS
+    assert(pos.hash() == computeZobristHash(pos));
+    assert(boardIsConsistent(pos));
+    assert(evaluationIsConsistent(pos));
+    assert(!isSquareAttacked<THEM<Us>>(pos, pos.bitboards[OWN_PIECES<Us> + WHITE_KING]));
+#endif
+}
+
+void makeMove(Position& pos, Move move) {
+    LOG(LOG_TRACE, LOG_MOVEGEN, "make " << moveToString(move) << " at ply " << pos.gamePly);
+    if (pos.isWhiteTurn) makeMove<WHITE>(pos, move);
+    else makeMove<BLACK>(pos, move);
+}
+
+// Take back the last move, which side Us made
+template <Color Us>
+void undoMove(Position& pos) {
+    const UndoInfo& undo = pos.undoStack[--pos.gamePly];
+
+    pos.isWhiteTurn = Us == WHITE;
+    int fromSquare = moveFrom(undo.move);
+    int toSquare = moveTo(undo.move);
+    int flags = moveFlags(undo.move);
+
+    if (flags & 8) {
+        removePiece<Us>(pos, pieceOn(pos, toSquare), toSquare);
+        putPiece<Us>(pos, undo.movedPiece, fromSquare);
+    } else {
+        movePiece<Us>(pos, undo.movedPiece, toSquare, fromSquare);
+    }
+
+    if (flags == KING_CASTLE || flags == QUEEN_CASTLE) {
+        movePiece<Us>(pos, OWN_PIECES<Us> + WHITE_ROOK, castlingRookTo(flags, toSquare), castlingRookFrom(flags, toSquare));
+    }
+
+    if (undo.capturedPiece != NO_PIECE) {
+        int capturedSquare = flags == EN_PASSANT ? toSquare - FORWARD<Us> : toSquare;
+        putPiece<THEM<Us>>(pos, undo.capturedPiece, capturedSquare);
+    }
+
+    pos.castlingRights = undo.castlingRights;
+    pos.enPassantTarget = undo.enPassantSquare >= 0 ? 1ULL << undo.enPassantSquare : 0;
+    pos.halfmoveClock = undo.halfmoveClock;
+    pos.zobristKey = undo.hash;
+#ifdef CHESS_DEBUG_CHECKS
+    assert(pos.hash() == computeZobristHash(pos));
+    assert(boardIsConsistent(pos));
+    assert(evaluationIsConsistent(pos));
+#endif
+}
+
+// Take back the last move made with makeMove
+void undoMove(Position& pos) {
+    if (pos.gamePly == 0) return;
+    if (pos.isWhiteTurn) undoMove<BLACK>(pos);
+    else undoMove<WHITE>(pos);
+}
+
+// Pass the turn without moving, for null-move pruning. Must be paired with undoNullMove
+void makeNullMove(Position& pos) {
+    assert(pos.gamePly < MAX_GAME_PLY);
+    UndoInfo& undo = pos.undoStack[pos.gamePly++];
+    undo.hash = pos.zobristKey;
+    undo.move = NULL_MOVE;
+    undo.movedPiece = undo.capturedPiece = NO_PIECE;
+    undo.castlingRights = pos.castlingRights;
+    undo.enPassantSquare = pos.enPassantTarget ? (int8_t)__builtin_ctzll(pos.enPassantTarget) : -1;
+    undo.halfmoveClock = pos.halfmoveClock;
+
+    uint64_t hash = pos.zobristKey ^ castlingAndEnPassantHash(pos) ^ zobristSideKey;
+    pos.enPassantTarget = 0;
+    pos.halfmoveClock = (uint8_t)min(pos.halfmoveClock + 1, 255);
+    pos.isWhiteTurn = !pos.isWhiteTurn;
+    pos.zobristKey = hash ^ castlingAndEnPassantHash(pos);
+#ifdef CHESS_DEBUG_CHECKS
+    assert(pos.hash() == computeZobristHash(pos));
+#endif
+}
+
+void undoNullMove(Position& pos) {
+    const UndoInfo& undo = pos.undoStack[--pos.gamePly];
+    assert(undo.move == NULL_MOVE);
+    pos.isWhiteTurn = !pos.isWhiteTurn;
+    pos.enPassantTarget = undo.enPassantSquare >= 0 ? 1ULL << undo.enPassantSquare : 0;
+    pos.halfmoveClock = undo.halfmoveClock;
+    pos.zobristKey = undo.hash;
+}
+
+// Once a game nears MAX_GAME_PLY, drop the undo records from before the last capture or pawn move;
+// nothing looks further back than the halfmove clock, and those moves are never taken back
+void trimHistory(Position& pos) {
+    if (pos.gamePly < MAX_GAME_PLY - GAME_PLY_HEADROOM) return;
+    int keep = min((int)pos.halfmoveClock, pos.gamePly);
+    copy(pos.undoStack + pos.gamePly - keep, pos.undoStack + pos.gamePly, pos.undoStack);
+    pos.gamePly = keep;
+}
+
+// Enhanced function to determine if a position is checkmate or stalemate
+bool isCheckmateOrStalemate(const Position& pos) {
+    MoveList moves;
+    generateMoves(pos, moves);
+    return moves.size() == 0;
+}
+
+// Find the generated move matching a from/to square pair (and promotion piece, queen by default)
+Move findMove(const Position& pos, int fromSquare, int toSquare, char promotion) {
+    MoveList moves;
+    generateMoves(pos, moves);
+
+    int promotionFlag = QUEEN_PROMOTION;
+    if (promotion == 'n') promotionFlag = KNIGHT_PROMOTION;
+    else if (promotion == 'b') promotionFlag = BISHOP_PROMOTION;
+    else if (promotion == 'r') promotionFlag = ROOK_PROMOTION;
+
+    for (Move move : moves) {
+        if (moveFrom(move) != fromSquare || moveTo(move) != toSquare) continue;
+        if (isPromotionMove(move) && (moveFlags(move) & ~CAPTURE) != promotionFlag) continue;
+        return move;
+    }
+    return NULL_MOVE;
+}
+
+// Standard algebraic notation of a legal move in this position, e.g. "Nbd7", "exd5", "O-O" or "e8=Q+"
+string moveToSan(Position& pos, Move move) {
+    int from = moveFrom(move), to = moveTo(move), flags = moveFlags(move);
+    int piece = pieceOn(pos, from) % 6;
+    string san;
+    if (flags == KING_CASTLE) {
+        san = "O-O";
+    } else if (flags == QUEEN_CASTLE) {
+        san = "O-O-O";
+    } else {
+        if (piece == WHITE_PAWN) {
+            if (isCaptureMove(move)) san += (char)('a' + from % 8);
+        } else {
+            san += "NBRQK"[piece - 1];
+            // Name the origin file if that tells the candidates apart, else its rank, else both
+            MoveList moves;
+            generateMoves(pos, moves);
+            bool ambiguous = false, sameFile = false, sameRank = false;
+            for (Move other : moves) {
+                if (moveFrom(other) == from || moveTo(other) != to || pieceOn(pos, moveFrom(other)) % 6 != piece) continue;
+                ambiguous = true;
+                sameFile |= moveFrom(other) % 8 == from % 8;
+                sameRank |= moveFrom(other) / 8 == from / 8;
+            }
+            if (ambiguous && (!sameFile || sameRank)) san += (char)('a' + from % 8);
+            if (ambiguous && sameFile) san += (char)('1' + from / 8);
+        }
+        if (isCaptureMove(move)) san += 'x';
+        san += squareToNotation(1ULL << to);
+        if (isPromotionMove(move)) san += string("=") + "NBRQ"[flags & 3];
+    }
+
+    makeMove(pos, move);
+    if (isInCheck(pos)) san += isCheckmateOrStalemate(pos) ? '#' : '+';
+    undoMove(pos);
+    return san;
+}
+
+
+// Count leaf nodes of the legal move tree to the given depth, with side Us to move
+template <Color Us>
+uint64_t perft(Position& pos, int depth) {
+    if (depth == 0) return 1;
+
+    MoveList moves;
+    generateMoves<Us>(pos, moves);
+    if (depth == 1) return moves.size(); // Every generated move is legal, so the last ply needs no make/unmake
+
+    uint64_t nodes = 0;
+    for (Move move : moves) {
+        makeMove<Us>(pos, move);
+        nodes += perft<THEM<Us>>(pos, depth - 1);
+        undoMove<Us>(pos);
+    }
+    return nodes;
+}
+
+uint64_t perft(Position& pos, int depth) {
+    return pos.isWhiteTurn ? perft<WHITE>(pos, depth) : perft<BLACK>(pos, depth);
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void printPerftLine(int depth, uint64_t nodes, double seconds) {
+    cout << "depth " << depth << "  nodes " << nodes << "  time " << (int64_t)(seconds * 1000) << " ms  nps "
+         << (uint64_t)(seconds > 0 ? nodes / seconds : 0) << "\n";
+}
+
+// Perft for every depth from 1 up to maxDepth, with timing
+void runPerft(Position& pos, int maxDepth) {
+    for (int depth = 1; depth <= maxDepth; ++depth) {
+        auto start = chrono::steady_clock::now();
+        uint64_t nodes = perft(pos, depth);
+        printPerftLine(depth, nodes, secondsSince(start));
+    }
+}
+
+// Node count below each root move, for tracking down move generation bugs
+void divide(Position& pos, int depth) {
+    auto start = chrono::steady_clock::now();
+    MoveList moves;
+    generateMoves(pos, moves);
+    uint64_t total = 0;
+    for (Move move : moves) {
+        makeMove(pos, move);
+        uint64_t nodes = perft(pos, depth - 1);
+        cout << moveToString(move) << ": " << nodes << "\n";
+        total += nodes;
+        undoMove(pos);
+    }
+    printPerftLine(depth, total, secondsSince(start));
+}
+
+// Standard reference positions with known node counts for depths 1, 2, 3, ...
+struct PerftCase {
+    const char* name;
+    const char* fen;
+    vector<uint64_t> expected;
+};
+
+const PerftCase PERFT_SUITE[] = {
+    {"startpos", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", {20, 400, 8902, 197281, 4865609}},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", {48, 2039, 97862, 4085603}},
+    {"position3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", {14, 191, 2812, 43238, 674624}},
+    {"position4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", {6, 264, 9467, 422333}},
+    {"position4-mirrored", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", {6, 264, 9467, 422333}},
+    {"position5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", {44, 1486, 62379, 2103487}},
+    {"position6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", {46, 2079, 89890, 3894594}},
+};
+
+// Run every reference position; returns false on the first mismatch
+bool runPerftSuite() {
+    Position pos;
+    uint64_t totalNodes = 0;
+    auto suiteStart = chrono::steady_clock::now();
+    bool passed = true;
+
+    for (const PerftCase& test : PERFT_SUITE) {
+        setPositionFromFEN(pos, test.fen);
+        cout << test.name << " (" << test.fen << ")\n";
+        for (size_t i = 0; i < test.expected.size(); ++i) {
+            int depth = (int)i + 1;
+            auto start = chrono::steady_clock::now();
+            uint64_t nodes = perft(pos, depth);
+            printPerftLine(depth, nodes, secondsSince(start));
+            totalNodes += nodes;
+            if (nodes != test.expected[i]) {
+                cout << "  FAILED: expected " << test.expected[i] << "\n";
+                passed = false;
+                break;
+            }
+        }
+    }
+
+    double seconds = secondsSince(suiteStart);
+    cout << (passed ? "Perft suite passed: " : "Perft suite FAILED: ") << totalNodes << " nodes in "
+         << (int64_t)(seconds * 1000) << " ms (" << (uint64_t)(totalNodes / seconds) << " nps)\n";
+    return passed;
+}
+
+
+// Piece values, indexed by piece type (Piece % 6)
+const int PAWN_VALUE = 100;
+const int KNIGHT_VALUE = 320;
+const int BISHOP_VALUE = 330;
+const int ROOK_VALUE = 500;
+const int QUEEN_VALUE = 900;
+const int KING_VALUE = 20000;
+const int PIECE_VALUES[6] = {PAWN_VALUE, KNIGHT_VALUE, BISHOP_VALUE, ROOK_VALUE, QUEEN_VALUE, KING_VALUE};
+
+// Pawn structure terms, {middlegame, endgame}
+const int DOUBLED_PAWN_PENALTY[2] = {10, 20};   // Per pawn beyond the first on a file
+const int ISOLATED_PAWN_PENALTY[2] = {10, 15};  // No friendly pawn on an adjacent file
+const int BACKWARD_PAWN_PENALTY[2] = {8, 10};   // Stop square held by an enemy pawn and no friendly pawn can come to help
+const int PASSED_PAWN_BONUS[2][8] = {           // By rank counted from the pawn's own side
+    {0, 5, 10, 15, 30, 50, 80, 0},
+    {0, 10, 20, 35, 60, 100, 150, 0}};
+
+inline uint64_t northFill(uint64_t b) {
+    b |= b << 8;
+    b |= b << 16;
+    return b | (b << 32);
+}
+
+inline uint64_t southFill(uint64_t b) {
+    b |= b >> 8;
+    b |= b >> 16;
+    return b | (b >> 32);
+}
+
+// Everything the evaluation wants to know about one pawn structure
+struct PawnEntry {
+    uint64_t key = 0;
+    int midgame = 0, endgame = 0;  // Pawn structure score from White's point of view
+};
+
+// Score a pawn structure from scratch
+void evaluatePawns(const Position& pos, PawnEntry& entry) {
+    entry.key = pos.pawnKey;
+    entry.midgame = entry.endgame = 0;
+    uint64_t pawns[2] = {pos.bitboards[WHITE_PAWN], pos.bitboards[BLACK_PAWN]};
+    // Squares each color's pawns attack now or could attack after advancing, White first
+    uint64_t attackSpans[2] = {northFill(pawnAttacks(pawns[0], true)), southFill(pawnAttacks(pawns[1], false))};
+
+    for (int color = 0; color < 2; ++color) {
+        int sign = color == 0 ? 1 : -1;
+        uint64_t own = pawns[color], enemy = pawns[color ^ 1];
+        // Squares in front of enemy pawns or attackable by them; a pawn on none of these is passed
+        uint64_t enemyFront = color == 0 ? southFill(enemy >> 8) : northFill(enemy << 8);
+        uint64_t enemyAttacks = pawnAttacks(enemy, color == 1);
+
+        for (uint64_t remaining = own; remaining; remaining &= remaining - 1) {
+            int square = __builtin_ctzll(remaining);
+            int file = square % 8;
+            int relativeRank = color == 0 ? square / 8 : 7 - square / 8;
+            uint64_t fileMask = FILE_A << file;
+            uint64_t adjacentFiles = ((fileMask << 1) & ~FILE_A) | ((fileMask >> 1) & ~FILE_H);
+            uint64_t stopSquare = color == 0 ? (1ULL << square) << 8 : (1ULL << square) >> 8;
+            int midgame = 0, endgame = 0;
+
+            bool isolated = !(own & adjacentFiles);
+            if (isolated) {
+                midgame -= ISOLATED_PAWN_PENALTY[0];
+                endgame -= ISOLATED_PAWN_PENALTY[1];
+            } else if ((stopSquare & enemyAttacks) && !(stopSquare & attackSpans[color])) {
+                midgame -= BACKWARD_PAWN_PENALTY[0];
+                endgame -= BACKWARD_PAWN_PENALTY[1];
+            }
+            if (!((1ULL << square) & (enemyFront | attackSpans[color ^ 1]))) {
+                midgame += PASSED_PAWN_BONUS[0][relativeRank];
+                endgame += PASSED_PAWN_BONUS[1][relativeRank];
+            }
+            entry.midgame += sign * midgame;
+            entry.endgame += sign * endgame;
+        }
+
+        for (int file = 0; file < 8; ++file) {
+            int count = __builtin_popcountll(own & (FILE_A << file));
+            if (count > 1) {
+                entry.midgame -= sign * DOUBLED_PAWN_PENALTY[0] * (count - 1);
+                entry.endgame -= sign * DOUBLED_PAWN_PENALTY[1] * (count - 1);
+            }
+        }
+    }
+}
+
+// Per-thread cache of pawn structure evaluations, indexed by the pawn key. Pawn structures repeat far
+// more often than whole positions, so a small table hits most of the time
+struct PawnHashTable {
+    vector<PawnEntry> entries;
+    uint64_t probes = 0, hits = 0;
+
+    explicit PawnHashTable(size_t size = 1 << 14) : entries(size) {} // Must be a power of two
+
+    const PawnEntry& probe(const Position& pos) {
+        PawnEntry& entry = entries[pos.pawnKey & (entries.size() - 1)];
+        probes++;
+        if (entry.key == pos.pawnKey) hits++;
+        else evaluatePawns(pos, entry);
+        return entry;
+    }
+
+    void clear() {
+        fill(entries.begin(), entries.end(), PawnEntry{});
+    }
+};
+
+// Classical evaluation: material, piece-square and pawn structure terms, with the middlegame and endgame
+// sums blended by how much material is left. Without a pawn table the pawn terms are computed directly
+int classicalEvaluation(const Position& pos, PawnHashTable* pawnTable) {
+    PawnEntry scratch;
+    const PawnEntry* pawns = &scratch;
+    if (pawnTable) pawns = &pawnTable->probe(pos);
+    else evaluatePawns(pos, scratch);
+
+    int phase = min(pos.phase, MAX_PHASE); // Promotions can push the phase past the starting total
+    int midgame = pos.midgameScore + pawns->midgame, endgame = pos.endgameScore + pawns->endgame;
+    return (midgame * phase + endgame * (MAX_PHASE - phase)) / MAX_PHASE;
+}
+
+// Network output for the side to move, converted to White's point of view
+int nnueEvaluation(const Position& pos) {
+    int us = pos.isWhiteTurn ? 0 : 1;
+    int32_t output = nnueKernels.output(pos.accumulators[us], pos.accumulators[us ^ 1], network.outputWeights);
+    int score = (int)((int64_t)(output + network.outputBias) * NNUE_SCALE / (NNUE_QA * NNUE_QB));
+    return pos.isWhiteTurn ? score : -score;
+}
+
+// Evaluate the current position with the network if one is loaded, otherwise classically
+int evaluatePosition(const Position& pos, PawnHashTable* pawnTable = nullptr, bool allowNnue = true) {
+    return useNnue && allowNnue ? nnueEvaluation(pos) : classicalEvaluation(pos, pawnTable);
+}
+
+// Load quantised weights in the order of Network's fields (little-endian int16), as written by common
+// trainers for this architecture. Trailing padding is ignored. Positions set up earlier must be reset
+bool loadNetwork(const string& path) {
+    ifstream file(path, ios::binary);
+    auto read = [&file](void* data, size_t bytes) { return (bool)file.read((char*)data, bytes); };
+    if (!read(network.featureWeights, sizeof(network.featureWeights)) ||
+        !read(network.featureBias, sizeof(network.featureBias)) ||
+        !read(network.outputWeights, sizeof(network.outputWeights)) ||
+        !read(&network.outputBias, sizeof(network.outputBias))) {
+        LOG(LOG_ERROR, LOG_IO, "could not read a network from " << path);
+        useNnue = false;
+        return false;
+    }
+    selectNnueBackend(bestNnueBackend());
+    useNnue = true;
+    return true;
+}
+
+// Small random weights, so the network code paths can be timed and cross-checked without a trained file
+void randomizeNetwork() {
+    mt19937 gen(12345);
+    uniform_int_distribution<int> weight(-64, 64);
+    for (auto& row : network.featureWeights) {
+        for (int16_t& value : row) value = (int16_t)weight(gen);
+    }
+    for (int16_t& value : network.featureBias) value = (int16_t)weight(gen);
+    for (int16_t& value : network.outputWeights) value = (int16_t)weight(gen);
+    network.outputBias = (int16_t)weight(gen);
+}
+
+// Make, evaluate and unmake every root move in turn, for the classical evaluation and each NNUE backend
+// the CPU supports. Returns false if the NNUE backends disagree on any score. Without a loaded network
+// a random one is timed instead
+bool runEvalBenchmark(Position& pos, int iterations) {
+    bool hadNetwork = useNnue;
+    NnueBackend loadedBackend = nnueBackend;
+    if (!hadNetwork) {
+        randomizeNetwork();
+        cout << "No network loaded; timing a random network\n";
+    }
+
+    MoveList moves;
+    generateMoves(pos, moves);
+    if (moves.size() == 0) return true;
+
+    bool agree = true;
+    int64_t reference = 0;
+    for (int backend = -1; backend <= NNUE_AVX2; ++backend) {
+        if (backend >= 0 && !cpuSupportsNnueBackend((NnueBackend)backend)) continue;
+        useNnue = backend >= 0;
+        if (useNnue) selectNnueBackend((NnueBackend)backend);
+        resetHistory(pos); // Rebuild the accumulators for this backend
+
+        auto start = chrono::steady_clock::now();
+        int64_t checksum = 0;
+        for (int i = 0; i < iterations; ++i) {
+            makeMove(pos, moves[i % moves.size()]);
+            checksum += evaluatePosition(pos);
+            undoMove(pos);
+        }
+        double seconds = secondsSince(start);
+
+        const char* name = backend < 0 ? "classical" : NNUE_BACKEND_NAMES[backend];
+        cout << name << "  evals " << iterations << "  time " << (int64_t)(seconds * 1000) << " ms  evals/s "
+             << (uint64_t)(iterations / seconds) << "  checksum " << checksum << "\n";
+        if (backend == NNUE_SCALAR) reference = checksum;
+        else if (backend > NNUE_SCALAR && checksum != reference) agree = false;
+    }
+
+    useNnue = hadNetwork;
+    selectNnueBackend(loadedBackend);
+    resetHistory(pos);
+    if (!agree) cout << "NNUE backends disagree\n";
+    return agree;
+}
+
+
+
+// Syzygy endgame tablebases. For each material signature a WDL file ("KQvK.rtbw") holds the win, draw or
+// loss of every position, and a DTZ file ("KQvK.rtbz") holds the plies to the next capture or pawn move on
+// the best path. Both assume a halfmove clock of zero and no castling rights. En passant rights are not in
+// the tables either, so the prober searches captures before trusting a stored value. Files are found
+// when the path is set and memory-mapped the first time a position with their material is probed
+const int TB_MAX_PIECES = 7;
+const int TB_GENERATE_MAX_PIECES = 4; // tb-generate holds two bytes per placement of the men while solving
+const int TB_WIN_SCORE = 20000; // Minus the search ply; well clear of evaluations and of mate scores
+
+// Results for the side to move. Cursed wins and blessed losses are decided by the fifty-move rule
+const int WDL_LOSS = -2, WDL_BLESSED_LOSS = -1, WDL_DRAW = 0, WDL_CURSED_WIN = 1, WDL_WIN = 2;
+
+// Subtable flags. DTZ files hold one side to move (TB_STM) and may count in moves rather than plies
+const uint8_t TB_STM = 1, TB_MAPPED = 2, TB_WIN_PLIES = 4, TB_LOSS_PLIES = 8, TB_WIDE = 16, TB_SINGLE_VALUE = 128;
+
+enum ProbeState { PROBE_FAIL, PROBE_OK, PROBE_CHANGE_SIDE, PROBE_ZEROING_BEST_MOVE };
+
+// Index tables of the Syzygy encoding, filled by initializeTablebaseIndexing
+int tbBinomial[TB_MAX_PIECES][64];       // [k][n]: ways to choose k of n squares
+int tbPawnSquare[64];                     // a2-h7 to 47..0; the highest is the leading pawn
+int tbLeadPawnIndex[TB_MAX_PIECES][64];  // [leading pawns][square of the first]
+int tbLeadPawnSize[TB_MAX_PIECES][4];    // [leading pawns][file a-d of the first]
+int tbTriangle[64];                       // a1-d1-d4 triangle to 0..9, the diagonal squares last
+int tbBelowDiagonal[64];                  // Squares below the a1-h8 diagonal to 0..27
+int tbKingPairs[10][64];                  // The 462 placements of two kings, the first in the triangle
+
+// Ranks above minus files: positive above the a1-h8 diagonal, zero on it
+inline int diagonalOffset(int square) { return square / 8 - square % 8; }
+
+void initializeTablebaseIndexing() {
+    int code = 0;
+    for (int square = 0; square < 64; ++square) {
+        if (diagonalOffset(square) < 0) tbBelowDiagonal[square] = code++;
+    }
+
+    code = 0;
+    vector<int> diagonal;
+    for (int square : {0, 1, 2, 3, 8, 9, 10, 11, 16, 17, 18, 19, 24, 25, 26, 27}) {
+        if (diagonalOffset(square) < 0) tbTriangle[square] = code++;
+        else if (diagonalOffset(square) == 0) diagonal.push_back(square);
+    }
+    for (int square : diagonal) tbTriangle[square] = code++;
+
+    // Kings that touch are left out; with the first king on the diagonal the second stays on or below
+    // it, and placements with both on the diagonal come last. b1 is the triangle's code 0
+    code = 0;
+    vector<pair<int, int>> bothOnDiagonal;
+    for (int first = 0; first < 10; ++first) {
+        for (int square = 0; square <= 27; ++square) {
+            if (tbTriangle[square] != first || (first == 0 && square != 1)) continue;
+            for (int other = 0; other < 64; ++other) {
+                if ((kingAttacks(1ULL << square) | 1ULL << square) & 1ULL << other) continue;
+                if (diagonalOffset(square) == 0 && diagonalOffset(other) > 0) continue;
+                if (diagonalOffset(square) == 0 && diagonalOffset(other) == 0) bothOnDiagonal.push_back({first, other});
+                else tbKingPairs[first][other] = code++;
+            }
+        }
+    }
+    for (auto [first, other] : bothOnDiagonal) tbKingPairs[first][other] = code++;
+
+    tbBinomial[0][0] = 1;
+    for (int n = 1; n < 64; ++n) {
+        for (int k = 0; k < TB_MAX_PIECES && k <= n; ++k) {
+            tbBinomial[k][n] = (k > 0 ? tbBinomial[k - 1][n - 1] : 0) + (k < n ? tbBinomial[k][n - 1] : 0);
+        }
+    }
+
+    // Pawn squares are numbered from the edge files inward and up the board, so the pawn with the highest
+    // number leads and the others can only stand on lower-numbered squares
+    int available = 47;
+    for (int leadPawns = 1; leadPawns < TB_MAX_PIECES - 1; ++leadPawns) {
+        for (int file = 0; file < 4; ++file) {
+            int index = 0;
+            for (int rank = 1; rank <= 6; ++rank) {
+                int square = rank * 8 + file;
+                if (leadPawns == 1) {
+                    tbPawnSquare[square] = available--;
+                    tbPawnSquare[square ^ 7] = available--;
+                }
+                tbLeadPawnIndex[leadPawns][square] = index;
+                index += tbBinomial[leadPawns - 1][tbPawnSquare[square]];
+            }
+            tbLeadPawnSize[leadPawns][file] = index;
+        }
+    }
+}
+
+inline uint16_t readLittle16(const uint8_t* bytes) { return (uint16_t)(bytes[0] | bytes[1] << 8); }
+inline uint32_t readLittle32(const uint8_t* bytes) { return readLittle16(bytes) | (uint32_t)readLittle16(bytes + 2) << 16; }
+inline uint32_t readBig32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+// Syzygy piece codes: 1-6 for White's pawn to king, 9-14 for Black's
+inline int syzygyPiece(int piece) { return piece % 6 + 1 + (piece >= BLACK_PAWN ? 8 : 0); }
+
+// One subtable: the positions with one side to move and, with pawns, one file of the leading pawn. Values
+// are canonical Huffman codes for symbols, and each symbol stands for a run of values by recursive pairing
+struct PairsData {
+    uint8_t flags = 0;
+    int minSymbolLength = 0;                 // Or the value of every position, with TB_SINGLE_VALUE
+    uint32_t blockCount = 0, blockLengthSize = 0;
+    uint64_t blockSize = 0, span = 0, sparseIndexSize = 0;
+    const uint8_t* lowestSymbols = nullptr;  // Lowest symbol of each code length, 16-bit little endian
+    const uint8_t* symbolTree = nullptr;     // Two 12-bit halves per symbol, 0xFFF on the right for a leaf
+    const uint8_t* sparseIndex = nullptr;    // Block and offset of every span-th value, six bytes each
+    const uint8_t* blockLengths = nullptr;   // Values in each block minus one, 16-bit little endian
+    const uint8_t* data = nullptr;
+    vector<uint64_t> base;                   // Lowest code of each length, left-aligned in 64 bits
+    vector<uint8_t> symbolLength;            // Values a symbol stands for, minus one
+    int pieces[TB_MAX_PIECES] = {};          // Piece codes in encoding order
+    int groupLength[TB_MAX_PIECES + 1] = {}; // Men encoded together, zero-terminated
+    uint64_t groupIndex[TB_MAX_PIECES + 1] = {};
+    uint16_t mapIndex[4] = {};               // DTZ value maps for a win, loss, cursed win and blessed loss
+};
+
+struct TablebaseFile {
+    string path;
+    const uint8_t* data = nullptr;       // The whole mapping; null until opened, or if missing or malformed
+    size_t bytes = 0;
+    const uint8_t* valueMaps = nullptr;  // DTZ only
+    PairsData items[2][4];               // [side to move][file of the leading pawn, or 0 without pawns]
+    once_flag opened;
+
+    ~TablebaseFile() {
+        if (data) munmap((void*)data, bytes);
+    }
+};
+
+struct Tablebase {
+    string name;                // "KRvKN", the side named first usually the stronger
+    uint64_t key = 0, key2 = 0; // materialKey with the side named first as White, then as Black
+    int pieceCount = 0;
+    bool hasPawns = false;
+    bool hasUniquePieces = false; // Some side has exactly one of a piece type other than the king
+    int pawnCount[2] = {};      // The leading color's pawns, then the other side's
+    TablebaseFile wdl, dtz;
+};
+
+string tablebasePath;
+map<uint64_t, Tablebase> tablebases; // By key; filled by initializeTablebases, then only read
+int tablebaseProbeLimit = TB_MAX_PIECES; // Probe in search only with this many men or fewer
+
+// Piece counts packed four bits per piece, with the colors swapped when mirrored
+uint64_t materialKey(const Position& pos, bool mirrored) {
+    uint64_t key = 0;
+    for (int piece = 0; piece < 12; ++piece) {
+        key += (uint64_t)__builtin_popcountll(pos.bitboards[piece]) << (4 * (mirrored ? (piece + 6) % 12 : piece));
+    }
+    return key;
+}
+
+// Men of a table as pieces, the side named first as White, in the order of the name
+vector<int> tablebasePieces(const string& name) {
+    vector<int> pieces;
+    int color = 0;
+    for (char c : name) {
+        if (c == 'v') color = BLACK_PAWN;
+        else pieces.push_back(color + (int)string("PNBRQK").find(c));
+    }
+    return pieces;
+}
+
+// Fill in a table's material from its name; false if the name is not a material signature
+bool describeTablebase(const string& name, Tablebase& table) {
+    if (count(name.begin(), name.end(), 'v') != 1 || name.find_first_not_of("KQRBNPv") != string::npos) return false;
+    int counts[2][6] = {};
+    for (int piece : tablebasePieces(name)) counts[piece / 6][piece % 6]++;
+    if (counts[0][5] != 1 || counts[1][5] != 1 || name[0] != 'K' || name[name.find('v') + 1] != 'K') return false;
+
+    table.name = name;
+    table.key = table.key2 = 0;
+    table.pieceCount = 0;
+    table.hasUniquePieces = false;
+    for (int color = 0; color < 2; ++color) {
+        for (int type = 0; type < 6; ++type) {
+            table.key += (uint64_t)counts[color][type] << (4 * (type + 6 * color));
+            table.key2 += (uint64_t)counts[color][type] << (4 * (type + 6 * (1 - color)));
+            table.pieceCount += counts[color][type];
+            if (type != 5 && counts[color][type] == 1) table.hasUniquePieces = true;
+        }
+    }
+    // The side with fewer pawns leads, as that compresses better
+    bool whiteLeads = !counts[1][0] || (counts[0][0] && counts[1][0] >= counts[0][0]);
+    table.hasPawns = counts[0][0] + counts[1][0] > 0;
+    table.pawnCount[0] = counts[whiteLeads ? 0 : 1][0];
+    table.pawnCount[1] = counts[whiteLeads ? 1 : 0][0];
+    return table.pieceCount <= TB_MAX_PIECES;
+}
+
+// Register the WDL files in a list of directories separated by ':' and the DTZ files next to them or
+// in another of the directories; the files themselves are opened lazily
+void initializeTablebases(const string& directories) {
+    tablebases.clear();
+    tablebasePath = directories;
+    vector<string> paths;
+    istringstream list(directories);
+    for (string path; getline(list, path, ':');) {
+        if (!path.empty()) paths.push_back(path);
+    }
+    auto fileExists = [](const string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0;
+    };
+    for (const string& path : paths) {
+        DIR* directory = opendir(path.c_str());
+        if (!directory) continue;
+        while (dirent* entry = readdir(directory)) {
+            string file = entry->d_name;
+            if (file.size() < 6 || file.substr(file.size() - 5) != ".rtbw") continue;
+            string name = file.substr(0, file.size() - 5);
+            Tablebase candidate;
+            if (!describeTablebase(name, candidate) || tablebases.count(candidate.key)) continue;
+            Tablebase& table = tablebases[candidate.key];
+            describeTablebase(name, table);
+            table.wdl.path = path + "/" + file;
+            for (const string& other : paths) {
+                if (table.dtz.path.empty() && fileExists(other + "/" + name + ".rtbz")) table.dtz.path = other + "/" + name + ".rtbz";
+            }
+        }
+        closedir(directory);
+    }
+}
+
+inline int leftSymbol(const PairsData& d, int symbol) {
+    const uint8_t* node = d.symbolTree + 3 * symbol;
+    return (node[1] & 0xF) << 8 | node[0];
+}
+
+inline int rightSymbol(const PairsData& d, int symbol) {
+    const uint8_t* node = d.symbolTree + 3 * symbol;
+    return node[2] << 4 | node[1] >> 4;
+}
+
+// Group the men encoded together: identical men, and first the leading pawns or, without pawns, the two
+// kings plus a unique piece (or the kings alone). order says where the leading group and the remaining
+// pawns come among the factors of the index; the rest follow in sequence
+void setGroups(const Tablebase& table, PairsData& d, const int order[2], int leadFile) {
+    int n = 0, firstLength = table.hasPawns ? 0 : (table.hasUniquePieces ? 3 : 2);
+    d.groupLength[n] = 1;
+    for (int i = 1; i < table.pieceCount; ++i) {
+        if (--firstLength > 0 || d.pieces[i] == d.pieces[i - 1]) d.groupLength[n]++;
+        else d.groupLength[++n] = 1;
+    }
+    d.groupLength[++n] = 0;
+
+    bool bothPawns = table.hasPawns && table.pawnCount[1];
+    int next = bothPawns ? 2 : 1;
+    int freeSquares = 64 - d.groupLength[0] - (bothPawns ? d.groupLength[1] : 0);
+    uint64_t index = 1;
+    for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+        if (k == order[0]) {
+            d.groupIndex[0] = index;
+            index *= table.hasPawns ? tbLeadPawnSize[d.groupLength[0]][leadFile] : (table.hasUniquePieces ? 31332 : 462);
+        } else if (k == order[1]) {
+            d.groupIndex[1] = index;
+            index *= tbBinomial[d.groupLength[1]][48 - d.groupLength[0]];
+        } else {
+            d.groupIndex[next] = index;
+            index *= tbBinomial[d.groupLength[next]][freeSquares];
+            freeSquares -= d.groupLength[next++];
+        }
+    }
+    d.groupIndex[n] = index; // Size of the subtable
+}
+
+uint64_t subtableSize(const PairsData& d) {
+    int n = 0;
+    while (d.groupLength[n]) ++n;
+    return d.groupIndex[n];
+}
+
+// Values a symbol stands for, minus one: a leaf stands for one, a pair for both halves
+uint8_t expandedLength(PairsData& d, int symbol, vector<bool>& visited) {
+    visited[symbol] = true;
+    int right = rightSymbol(d, symbol);
+    if (right == 0xFFF) return 0;
+    int left = leftSymbol(d, symbol);
+    if (!visited[left]) d.symbolLength[left] = expandedLength(d, left, visited);
+    if (!visited[right]) d.symbolLength[right] = expandedLength(d, right, visited);
+    return d.symbolLength[left] + d.symbolLength[right] + 1;
+}
+
+// Read a subtable's block geometry and Huffman code; returns the first byte after it
+const uint8_t* setSizes(PairsData& d, const uint8_t* data) {
+    d.flags = *data++;
+    if (d.flags & TB_SINGLE_VALUE) {
+        d.minSymbolLength = *data++;
+        return data;
+    }
+    d.blockSize = 1ULL << *data++;
+    d.span = 1ULL << *data++;
+    d.sparseIndexSize = (subtableSize(d) + d.span - 1) / d.span;
+    int padding = *data++;
+    d.blockCount = readLittle32(data);
+    data += 4;
+    d.blockLengthSize = d.blockCount + padding;
+    int maxSymbolLength = *data++;
+    d.minSymbolLength = *data++;
+    d.lowestSymbols = data;
+
+    // Longer codes have lower values, so base[i] holds the lowest code of length minSymbolLength + i
+    d.base.assign(maxSymbolLength - d.minSymbolLength + 1, 0);
+    for (int i = (int)d.base.size() - 2; i >= 0; --i) {
+        d.base[i] = (d.base[i + 1] + readLittle16(d.lowestSymbols + 2 * i) - readLittle16(d.lowestSymbols + 2 * i + 2)) / 2;
+    }
+    for (size_t i = 0; i < d.base.size(); ++i) d.base[i] <<= 64 - i - d.minSymbolLength;
+    data += 2 * d.base.size();
+
+    d.symbolLength.assign(readLittle16(data), 0);
+    data += 2;
+    d.symbolTree = data;
+    vector<bool> visited(d.symbolLength.size());
+    for (size_t symbol = 0; symbol < d.symbolLength.size(); ++symbol) {
+        if (!visited[symbol]) d.symbolLength[symbol] = expandedLength(d, (int)symbol, visited);
+    }
+    return data + 3 * d.symbolLength.size() + (d.symbolLength.size() & 1);
+}
+
+// DTZ files may store small values through a per-result map, with 8 or 16-bit entries
+const uint8_t* setDtzMaps(const Tablebase& table, TablebaseFile& file, const uint8_t* data) {
+    file.valueMaps = data;
+    for (int leadFile = 0; leadFile < (table.hasPawns ? 4 : 1); ++leadFile) {
+        PairsData& d = file.items[0][leadFile];
+        if (!(d.flags & TB_MAPPED)) continue;
+        if (d.flags & TB_WIDE) {
+            data += (uintptr_t)data & 1;
+            for (int i = 0; i < 4; ++i) {
+                d.mapIndex[i] = (uint16_t)((data - file.valueMaps) / 2 + 1);
+                data += 2 * readLittle16(data) + 2;
+            }
+        } else {
+            for (int i = 0; i < 4; ++i) {
+                d.mapIndex[i] = (uint16_t)(data - file.valueMaps + 1);
+                data += *data + 1;
+            }
+        }
+    }
+    return data + ((uintptr_t)data & 1);
+}
+
+// Map a table file and read its subtable headers; leaves data null if the file is missing or malformed.
+// Alignment inside the file is relative to the mapping, which starts on a page boundary
+void openTablebaseFile(const Tablebase& table, TablebaseFile& file, bool isDtz) {
+    static const uint8_t magics[2][4] = {{0x71, 0xE8, 0x23, 0x5D}, {0xD7, 0x66, 0x0C, 0xA5}};
+    if (file.path.empty()) return;
+    int fd = ::open(file.path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat info;
+    const uint8_t* mapped = nullptr;
+    size_t bytes = 0;
+    if (fstat(fd, &info) == 0 && info.st_size % 64 == 16) {
+        void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED) {
+            mapped = (const uint8_t*)address;
+            bytes = info.st_size;
+        }
+    }
+    ::close(fd);
+    if (!mapped) return;
+    if (memcmp(mapped, magics[isDtz], 4) != 0 || (bool)(mapped[4] & 2) != table.hasPawns) {
+        munmap((void*)mapped, bytes);
+        return;
+    }
+
+    const uint8_t* data = mapped + 5;
+    int sides = isDtz || table.key == table.key2 ? 1 : 2, files = table.hasPawns ? 4 : 1;
+    bool bothPawns = table.hasPawns && table.pawnCount[1];
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        int order[2][2] = {{data[0] & 0xF, bothPawns ? data[1] & 0xF : 0xF}, {data[0] >> 4, bothPawns ? data[1] >> 4 : 0xF}};
+        data += 1 + bothPawns;
+        for (int k = 0; k < table.pieceCount; ++k, ++data) {
+            for (int side = 0; side < sides; ++side) file.items[side][leadFile].pieces[k] = side ? *data >> 4 : *data & 0xF;
+        }
+        for (int side = 0; side < sides; ++side) setGroups(table, file.items[side][leadFile], order[side], leadFile);
+    }
+    data += (uintptr_t)data & 1;
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        for (int side = 0; side < sides; ++side) data = setSizes(file.items[side][leadFile], data);
+    }
+    if (isDtz) data = setDtzMaps(table, file, data);
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        for (int side = 0; side < sides; ++side) {
+            file.items[side][leadFile].sparseIndex = data;
+            data += 6 * file.items[side][leadFile].sparseIndexSize;
+        }
+    }
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        for (int side = 0; side < sides; ++side) {
+            file.items[side][leadFile].blockLengths = data;
+            data += 2 * file.items[side][leadFile].blockLengthSize;
+        }
+    }
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        for (int side = 0; side < sides; ++side) {
+            PairsData& d = file.items[side][leadFile];
+            data = (const uint8_t*)(((uintptr_t)data + 63) & ~(uintptr_t)63);
+            d.data = data;
+            data += d.blockCount * d.blockSize;
+        }
+    }
+    if (data > mapped + bytes) {
+        munmap((void*)mapped, bytes);
+        return;
+    }
+    file.data = mapped;
+    file.bytes = bytes;
+}
+
+// Value number index of a subtable
+int decompressValue(const PairsData& d, uint64_t index) {
+    if (d.flags & TB_SINGLE_VALUE) return d.minSymbolLength;
+
+    // The sparse index gives the block and offset of value k * span + span / 2; step from there
+    // through the block lengths to the block holding our value
+    const uint8_t* entry = d.sparseIndex + 6 * (index / d.span);
+    uint32_t block = readLittle32(entry);
+    int offset = readLittle16(entry + 4) + (int)(index % d.span) - (int)(d.span / 2);
+    while (offset < 0) offset += readLittle16(d.blockLengths + 2 * --block) + 1;
+    while (offset > readLittle16(d.blockLengths + 2 * block)) offset -= readLittle16(d.blockLengths + 2 * block++) + 1;
+
+    // Walk the block's codes, most significant bit first, until the symbol covering our offset
+    const uint8_t* next = d.data + block * d.blockSize;
+    uint64_t buffer = (uint64_t)readBig32(next) << 32 | readBig32(next + 4);
+    next += 8;
+    int bufferBits = 64, symbol;
+    while (true) {
+        size_t length = 0;
+        while (buffer < d.base[length]) ++length;
+        symbol = (int)((buffer - d.base[length]) >> (64 - length - d.minSymbolLength));
+        symbol = (uint16_t)(symbol + readLittle16(d.lowestSymbols + 2 * length));
+        if (offset < d.symbolLength[symbol] + 1) break;
+        offset -= d.symbolLength[symbol] + 1;
+        length += d.minSymbolLength;
+        buffer <<= length;
+        bufferBits -= (int)length;
+        if (bufferBits <= 32) {
+            bufferBits += 32;
+            buffer |= (uint64_t)readBig32(next) << (64 - bufferBits);
+            next += 4;
+        }
+    }
+
+    // Then descend the pairs to the leaf holding the value
+    while (d.symbolLength[symbol]) {
+        int left = leftSymbol(d, symbol);
+        if (offset < d.symbolLength[left] + 1) {
+            symbol = left;
+        } else {
+            offset -= d.symbolLength[left] + 1;
+            symbol = rightSymbol(d, symbol);
+        }
+    }
+    return leftSymbol(d, symbol);
+}
+
+// Index of a position in the table's file, plus the subtable it lies in: the side to move after any
+// color swap, and the file of the leading pawn. The file is seen with the side named first as White,
+// the leading man moved into the a1-d1-d4 triangle (pawns to files a-d), and identical men as a set
+uint64_t tablebaseIndex(const Tablebase& table, const TablebaseFile& file, bool isDtz, const Position& pos, int& side,
+                        int& leadFile) {
+    // Symmetric material is stored with White to move only; otherwise swap when Black has the first-named side
+    bool flip = (table.key == table.key2 && !pos.isWhiteTurn) || materialKey(pos, false) != table.key;
+    int colorFlip = flip ? 8 : 0, squareFlip = flip ? 56 : 0;
+    side = flip == pos.isWhiteTurn;
+
+    int squares[TB_MAX_PIECES]{}, pieces[TB_MAX_PIECES]{}, size = 0, leadPawnCount = 0;
+    uint64_t leadPawns = 0;
+    leadFile = 0;
+    if (table.hasPawns) {
+        int leadPawn = file.items[0][0].pieces[0] ^ colorFlip;
+        leadPawns = pos.bitboards[leadPawn == 1 ? WHITE_PAWN : BLACK_PAWN];
+        for (uint64_t bits = leadPawns; bits; bits &= bits - 1) squares[size++] = __builtin_ctzll(bits) ^ squareFlip;
+        leadPawnCount = size;
+        swap(squares[0], *max_element(squares, squares + size, [](int a, int b) { return tbPawnSquare[a] < tbPawnSquare[b]; }));
+        leadFile = min(squares[0] % 8, 7 - squares[0] % 8);
+    }
+    for (uint64_t bits = pos.allPieces & ~leadPawns; bits; bits &= bits - 1) {
+        int square = __builtin_ctzll(bits);
+        squares[size] = square ^ squareFlip;
+        pieces[size++] = syzygyPiece(pos.board[square]) ^ colorFlip;
+    }
+
+    const PairsData& d = file.items[isDtz ? 0 : side][leadFile];
+    for (int i = leadPawnCount; i < size - 1; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            if (d.pieces[i] == pieces[j]) {
+                swap(pieces[i], pieces[j]);
+                swap(squares[i], squares[j]);
+                break;
+            }
+        }
+    }
+    if (squares[0] % 8 > 3) {
+        for (int i = 0; i < size; ++i) squares[i] ^= 7;
+    }
+
+    uint64_t index;
+    if (table.hasPawns) {
+        index = tbLeadPawnIndex[leadPawnCount][squares[0]];
+        stable_sort(squares + 1, squares + leadPawnCount, [](int a, int b) { return tbPawnSquare[a] < tbPawnSquare[b]; });
+        for (int i = 1; i < leadPawnCount; ++i) index += tbBinomial[i][tbPawnSquare[squares[i]]];
+    } else {
+        if (squares[0] / 8 > 3) {
+            for (int i = 0; i < size; ++i) squares[i] ^= 56;
+        }
+        // The first leading man off the a1-h8 diagonal goes below it
+        for (int i = 0; i < d.groupLength[0]; ++i) {
+            if (diagonalOffset(squares[i]) == 0) continue;
+            if (diagonalOffset(squares[i]) > 0) {
+                for (int j = i; j < size; ++j) squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+            }
+            break;
+        }
+        if (table.hasUniquePieces) {
+            int adjust1 = squares[1] > squares[0];
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+            if (diagonalOffset(squares[0])) {
+                index = (tbTriangle[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            } else if (diagonalOffset(squares[1])) {
+                index = (6 * 63 + (squares[0] / 8) * 28 + tbBelowDiagonal[squares[1]]) * 62 + squares[2] - adjust2;
+            } else if (diagonalOffset(squares[2])) {
+                index = 6 * 63 * 62 + 4 * 28 * 62 + (squares[0] / 8) * 7 * 28 + (squares[1] / 8 - adjust1) * 28 +
+                        tbBelowDiagonal[squares[2]];
+            } else {
+                index = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + (squares[0] / 8) * 7 * 6 + (squares[1] / 8 - adjust1) * 6 +
+                        (squares[2] / 8 - adjust2);
+            }
+        } else {
+            index = tbKingPairs[tbTriangle[squares[0]]][squares[1]];
+        }
+    }
+
+    // The other groups in ascending square order, each square less the men of earlier groups below it
+    index *= d.groupIndex[0];
+    int* group = squares + d.groupLength[0];
+    bool remainingPawns = table.hasPawns && table.pawnCount[1];
+    for (int next = 1; d.groupLength[next]; ++next) {
+        int length = d.groupLength[next];
+        stable_sort(group, group + length);
+        uint64_t n = 0;
+        for (int i = 0; i < length; ++i) {
+            int adjust = (int)count_if(squares, group, [&](int square) { return group[i] > square; });
+            n += tbBinomial[i + 1][group[i] - adjust - 8 * remainingPawns];
+        }
+        remainingPawns = false;
+        index += n * d.groupIndex[next];
+        group += length;
+    }
+    return index;
+}
+
+Tablebase* findTablebase(const Position& pos) {
+    auto found = tablebases.find(materialKey(pos, false));
+    if (found == tablebases.end()) found = tablebases.find(materialKey(pos, true));
+    return found == tablebases.end() ? nullptr : &found->second;
+}
+
+// The stored value of a position: its result from the WDL file, or from the DTZ file the plies to a
+// zeroing move given the result wdl. State is PROBE_CHANGE_SIDE if the DTZ file holds the other side to move
+int probeTable(const Position& pos, bool isDtz, ProbeState& state, int wdl = WDL_DRAW) {
+    if (__builtin_popcountll(pos.allPieces) == 2) return WDL_DRAW;
+    Tablebase* table = findTablebase(pos);
+    if (!table) {
+        state = PROBE_FAIL;
+        return 0;
+    }
+    TablebaseFile& file = isDtz ? table->dtz : table->wdl;
+    call_once(file.opened, [&]() { openTablebaseFile(*table, file, isDtz); });
+    if (!file.data) {
+        state = PROBE_FAIL;
+        return 0;
+    }
+
+    int side, leadFile;
+    uint64_t index = tablebaseIndex(*table, file, isDtz, pos, side, leadFile);
+    const PairsData& d = file.items[isDtz ? 0 : side][leadFile];
+    if (!isDtz) return decompressValue(d, index) - 2;
+    if ((d.flags & TB_STM) != side && !(table->key == table->key2 && !table->hasPawns)) {
+        state = PROBE_CHANGE_SIDE;
+        return 0;
+    }
+
+    int value = decompressValue(d, index);
+    if (d.flags & TB_MAPPED) {
+        static const int mapForResult[] = {1, 3, 0, 2, 0}; // By wdl + 2
+        int entry = d.mapIndex[mapForResult[wdl + 2]] + value;
+        value = d.flags & TB_WIDE ? readLittle16(file.valueMaps + 2 * entry) : file.valueMaps[entry];
+    }
+    // Values counted in moves are converted to plies
+    if ((wdl == WDL_WIN && !(d.flags & TB_WIN_PLIES)) || (wdl == WDL_LOSS && !(d.flags & TB_LOSS_PLIES)) ||
+        wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS) {
+        value *= 2;
+    }
+    return value + 1;
+}
+
+inline bool isPawnMove(const Position& pos, Move move) { return pos.board[moveFrom(move)] % 6 == WHITE_PAWN; }
+
+// Result of the position for the side to move. The tables store a don't-care value wherever a capture
+// is best, so captures are searched first; with checkZeroing pawn moves too, and state then says whether
+// a capture or pawn move wins outright (the DTZ files hold nothing useful there)
+int searchTablebase(Position& pos, ProbeState& state, bool checkZeroing) {
+    MoveList moves;
+    generateMoves(pos, moves);
+    int best = WDL_LOSS;
+    int searched = 0;
+    for (Move move : moves) {
+        if (!isCaptureMove(move) && !(checkZeroing && isPawnMove(pos, move))) continue;
+        searched++;
+        makeMove(pos, move);
+        int value = -searchTablebase(pos, state, false);
+        undoMove(pos);
+        if (state == PROBE_FAIL) return WDL_DRAW;
+        if (value > best) {
+            best = value;
+            if (value >= WDL_WIN) {
+                state = PROBE_ZEROING_BEST_MOVE;
+                return value;
+            }
+        }
+    }
+
+    // With every move searched the stored value is not needed, and may be wrong after a double push
+    bool noMoreMoves = searched > 0 && searched == moves.size();
+    int value = best;
+    if (!noMoreMoves) {
+        value = probeTable(pos, false, state);
+        if (state == PROBE_FAIL) return WDL_DRAW;
+    }
+    if (best >= value) {
+        state = best > WDL_DRAW || noMoreMoves ? PROBE_ZEROING_BEST_MOVE : PROBE_OK;
+        return best;
+    }
+    state = PROBE_OK;
+    return value;
+}
+
+// Result for the side to move (WDL_LOSS to WDL_WIN); state is PROBE_FAIL if a table is missing
+int probeWdl(Position& pos, ProbeState& state) {
+    state = PROBE_OK;
+    return searchTablebase(pos, state, false);
+}
+
+// DTZ of the position before a zeroing move that leaves the result wdl
+inline int dtzBeforeZeroing(int wdl) {
+    return wdl == WDL_WIN ? 1 : wdl == WDL_CURSED_WIN ? 101 : wdl == WDL_BLESSED_LOSS ? -101 : wdl == WDL_LOSS ? -1 : 0;
+}
+
+inline bool isCheckmate(const Position& pos) {
+    MoveList moves;
+    generateMoves(pos, moves);
+    return moves.size() == 0 && isInCheck(pos);
+}
+
+// Plies to the next capture or pawn move with best play: positive when winning, negative when losing,
+// beyond 100 when the fifty-move rule turns the result into a draw, and 0 for a draw
+int probeDtz(Position& pos, ProbeState& state) {
+    state = PROBE_OK;
+    int wdl = searchTablebase(pos, state, true);
+    if (state == PROBE_FAIL || wdl == WDL_DRAW) return 0;
+    if (state == PROBE_ZEROING_BEST_MOVE) return dtzBeforeZeroing(wdl);
+
+    int dtz = probeTable(pos, true, state, wdl);
+    if (state == PROBE_FAIL) return 0;
+    if (state != PROBE_CHANGE_SIDE) {
+        return (dtz + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) * (wdl > 0 ? 1 : -1);
+    }
+
+    // The file holds the other side to move: one ply deeper, the fastest win or the slowest loss
+    int best = 0xFFFF;
+    MoveList moves;
+    generateMoves(pos, moves);
+    for (Move move : moves) {
+        bool zeroing = isCaptureMove(move) || isPawnMove(pos, move);
+        makeMove(pos, move);
+        int value = zeroing ? -dtzBeforeZeroing(searchTablebase(pos, state, false)) : -probeDtz(pos, state);
+        if (value == 1 && isCheckmate(pos)) best = 1;
+        if (!zeroing) value += (value > 0) - (value < 0);
+        if (value < best && (value > 0) == (wdl > 0) && value != 0) best = value;
+        undoMove(pos);
+        if (state == PROBE_FAIL) return 0;
+    }
+    return best == 0xFFFF ? -1 : best;
+}
+
+// tb-generate solves a table in memory over a plain layout, six bits per man in `pieces` order plus the
+// side to move, then writes it out in the Syzygy layout
+size_t solverIndex(const vector<int>& pieces, const Position& pos) {
+    uint64_t remaining[12];
+    copy(begin(pos.bitboards), end(pos.bitboards), remaining);
+    size_t index = 0;
+    int shift = 0;
+    for (int piece : pieces) {
+        index |= (size_t)__builtin_ctzll(remaining[piece]) << shift;
+        remaining[piece] &= remaining[piece] - 1;
+        shift += 6;
+    }
+    return index * 2 + (pos.isWhiteTurn ? 0 : 1);
+}
+
+// Set up the position of a solver index; false if it is not a legal position (overlapping men, pawns on
+// the first or last rank, identical pieces out of order, or the side not to move in check)
+bool solverPosition(const vector<int>& pieces, size_t index, Position& pos) {
+    fill(begin(pos.bitboards), end(pos.bitboards), 0);
+    pos.isWhiteTurn = (index & 1) == 0;
+    index >>= 1;
+    uint64_t occupied = 0;
+    for (size_t i = 0; i < pieces.size(); ++i, index >>= 6) {
+        int piece = pieces[i], square = (int)(index & 63);
+        if ((occupied & (1ULL << square)) || (piece % 6 == WHITE_PAWN && (square < 8 || square >= 56))) return false;
+        if (i > 0 && pieces[i - 1] == piece && (1ULL << square) < pos.bitboards[piece]) return false;
+        occupied |= 1ULL << square;
+        pos.bitboards[piece] |= 1ULL << square;
+    }
+    pos.castlingRights = 0;
+    pos.enPassantTarget = 0;
+    pos.halfmoveClock = 0;
+    resetHistory(pos);
+    return !isSquareAttacked(pos, pos.bitboards[pos.isWhiteTurn ? BLACK_KING : WHITE_KING], pos.isWhiteTurn);
+}
+
+// Visit every index below count on one thread per core, in blocks of neighbouring indices; returns the
+// sum of what the visits return
+template <typename Visit>
+size_t forEachTableIndex(size_t count, Visit visit) {
+    atomic<size_t> nextBlock{0};
+    atomic<size_t> total{0};
+    vector<thread> workers;
+    for (unsigned t = 0; t < max(thread::hardware_concurrency(), 1u); ++t) {
+        workers.emplace_back([&]() {
+            auto pos = make_unique<Position>();
+            size_t sum = 0;
+            for (size_t start; (start = nextBlock.fetch_add(4096)) < count;) {
+                for (size_t index = start; index < min(start + 4096, count); ++index) sum += visit(*pos, index);
+            }
+            total += sum;
+        });
+    }
+    for (thread& worker : workers) worker.join();
+    return total.load();
+}
+
+// Men in the order the written files encode them: the leading pawns then the other side's pawns or,
+// without pawns, the white king, a unique piece and the black king; then runs of identical men
+vector<int> encodingOrder(const Tablebase& table, const vector<int>& pieces) {
+    vector<int> codes;
+    for (int piece : pieces) codes.push_back(syzygyPiece(piece));
+    sort(codes.begin(), codes.end());
+    vector<int> first;
+    if (table.hasPawns) {
+        int whitePawns = (int)count(codes.begin(), codes.end(), 1), blackPawns = (int)count(codes.begin(), codes.end(), 9);
+        int leadPawn = !blackPawns || (whitePawns && blackPawns >= whitePawns) ? 1 : 9;
+        first.assign(table.pawnCount[0], leadPawn);
+        first.insert(first.end(), table.pawnCount[1], leadPawn ^ 8);
+    } else {
+        first.push_back(6);
+        if (table.hasUniquePieces) {
+            for (int code : codes) {
+                if (code % 8 != 6 && count(codes.begin(), codes.end(), code) == 1) {
+                    first.push_back(code);
+                    break;
+                }
+            }
+        }
+        first.push_back(14);
+    }
+    for (int code : first) codes.erase(find(codes.begin(), codes.end(), code));
+    first.insert(first.end(), codes.begin(), codes.end());
+    return first;
+}
+
+// Huffman-coded values of one subtable: every value as a leaf symbol with a code of fixed length, in
+// 64-byte blocks. A subtable with one value throughout is stored as just that value
+struct EncodedSubtable {
+    vector<uint8_t> sizes, sparseIndex, blockLengths, blocks;
+};
+
+EncodedSubtable encodeSubtable(const vector<int>& values, uint8_t flags) {
+    EncodedSubtable out;
+    auto pushLittle = [](vector<uint8_t>& bytes, uint32_t value, int count) {
+        for (int i = 0; i < count; ++i) bytes.push_back((uint8_t)(value >> (8 * i)));
+    };
+    int maxValue = *max_element(values.begin(), values.end());
+    if (*min_element(values.begin(), values.end()) == maxValue) {
+        out.sizes = {(uint8_t)(flags | TB_SINGLE_VALUE), (uint8_t)maxValue};
+        return out;
+    }
+    const int blockBits = 6, spanBits = 10;
+    int codeLength = 1;
+    while ((1 << codeLength) <= maxValue) codeLength++;
+    size_t perBlock = (8 << blockBits) / codeLength, span = (size_t)1 << spanBits;
+    uint32_t blockCount = (uint32_t)((values.size() + perBlock - 1) / perBlock);
+    int symbols = maxValue + 1;
+
+    out.sizes = {flags, (uint8_t)blockBits, (uint8_t)spanBits, 0};
+    pushLittle(out.sizes, blockCount, 4);
+    out.sizes.push_back((uint8_t)codeLength);
+    out.sizes.push_back((uint8_t)codeLength);
+    pushLittle(out.sizes, 0, 2); // Lowest symbol of the one code length
+    pushLittle(out.sizes, symbols, 2);
+    for (int symbol = 0; symbol < symbols; ++symbol) {
+        out.sizes.insert(out.sizes.end(), {(uint8_t)symbol, (uint8_t)(symbol >> 8 | 0xF0), 0xFF});
+    }
+    if (symbols & 1) out.sizes.push_back(0);
+
+    for (size_t k = 0; k < (values.size() + span - 1) / span; ++k) {
+        size_t middle = k * span + span / 2;
+        size_t block = min(middle / perBlock, (size_t)blockCount - 1);
+        pushLittle(out.sparseIndex, (uint32_t)block, 4);
+        pushLittle(out.sparseIndex, (uint32_t)(middle - block * perBlock), 2);
+    }
+    for (uint32_t block = 0; block < blockCount; ++block) {
+        pushLittle(out.blockLengths, (uint32_t)(min(perBlock, values.size() - block * perBlock) - 1), 2);
+    }
+    out.blocks.assign((size_t)blockCount << blockBits, 0);
+    for (size_t i = 0; i < values.size(); ++i) {
+        size_t bit = (i / perBlock << (blockBits + 3)) + i % perBlock * codeLength;
+        for (int b = codeLength - 1; b >= 0; --b, ++bit) {
+            if (values[i] >> b & 1) out.blocks[bit / 8] |= (uint8_t)(0x80 >> bit % 8);
+        }
+    }
+    return out;
+}
+
+// Write a solved table as a WDL or DTZ file. Every position is placed by the prober's own index; indices
+// no legal position reaches hold a draw, and the DTZ file holds the side named first to move
+bool writeTablebaseFile(const Tablebase& table, bool isDtz, const vector<int>& pieces, const vector<int8_t>& results,
+                        const vector<int16_t>& distances, const string& path) {
+    TablebaseFile file;
+    int sides = isDtz || table.key == table.key2 ? 1 : 2, files = table.hasPawns ? 4 : 1;
+    bool bothPawns = table.hasPawns && table.pawnCount[1];
+    vector<int> order = encodingOrder(table, pieces);
+    const int groupOrder[2] = {0, bothPawns ? 1 : 0xF};
+    vector<vector<int>> values(sides * files);
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        for (int side = 0; side < sides; ++side) {
+            PairsData& d = file.items[side][leadFile];
+            copy(order.begin(), order.end(), d.pieces);
+            setGroups(table, d, groupOrder, leadFile);
+            values[side * files + leadFile].assign(subtableSize(d), -1);
+        }
+    }
+    auto pos = make_unique<Position>();
+    for (size_t index = 0; index < results.size(); ++index) {
+        if (results[index] > WDL_WIN || !solverPosition(pieces, index, *pos)) continue;
+        int side, leadFile;
+        uint64_t entry = tablebaseIndex(table, file, isDtz, *pos, side, leadFile);
+        if (isDtz && side != 0) continue;
+        int value = isDtz ? max(abs(distances[index]) - 1, 0) : results[index] + 2;
+        vector<int>& subtable = values[(isDtz ? 0 : side) * files + leadFile];
+        // Positions sharing an index are mirror images, so they must agree
+        if (entry >= subtable.size() || (subtable[entry] != -1 && subtable[entry] != value)) {
+            cout << table.name << ": no consistent index for " << index << "\n";
+            return false;
+        }
+        subtable[entry] = value;
+    }
+    for (vector<int>& subtable : values) {
+        replace(subtable.begin(), subtable.end(), -1, isDtz ? 0 : WDL_DRAW + 2);
+    }
+
+    vector<uint8_t> bytes = {0x71, 0xE8, 0x23, 0x5D};
+    if (isDtz) bytes = {0xD7, 0x66, 0x0C, 0xA5};
+    bytes.push_back((uint8_t)((table.key != table.key2) | table.hasPawns << 1));
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        bytes.push_back(0x00);
+        if (bothPawns) bytes.push_back(0x11);
+        for (int code : order) bytes.push_back((uint8_t)(code | code << 4));
+    }
+    if (bytes.size() & 1) bytes.push_back(0);
+    vector<EncodedSubtable> subtables;
+    for (int leadFile = 0; leadFile < files; ++leadFile) {
+        for (int side = 0; side < sides; ++side) {
+            subtables.push_back(encodeSubtable(values[side * files + leadFile], isDtz ? TB_WIN_PLIES | TB_LOSS_PLIES : 0));
+        }
+    }
+    for (auto& subtable : subtables) bytes.insert(bytes.end(), subtable.sizes.begin(), subtable.sizes.end());
+    for (auto& subtable : subtables) bytes.insert(bytes.end(), subtable.sparseIndex.begin(), subtable.sparseIndex.end());
+    for (auto& subtable : subtables) bytes.insert(bytes.end(), subtable.blockLengths.begin(), subtable.blockLengths.end());
+    for (auto& subtable : subtables) {
+        bytes.resize((bytes.size() + 63) & ~(size_t)63, 0);
+        bytes.insert(bytes.end(), subtable.blocks.begin(), subtable.blocks.end());
+    }
+    bytes.resize(((bytes.size() + 63) & ~(size_t)63) + 16, 0); // The prober reads a little past the last block
+
+    ofstream out(path, ios::binary);
+    out.write((const char*)bytes.data(), bytes.size());
+    return (bool)out;
+}
+
+// Solve one table: first the results by repeated passes (a position is won if some move leads to a lost
+// position, lost if every move leads to a won one, and whatever is still open at the end is drawn), then
+// the plies to a zeroing move. Captures and promotions lead into the smaller tables, already written.
+// The fifty-move rule never changes a result with this few men, so there are no cursed wins
+bool generateTablebase(const Tablebase& table, const string& directory) {
+    const int8_t OPEN = 3, ILLEGAL = 4;
+    vector<int> pieces = tablebasePieces(table.name);
+    size_t count = (size_t)2 << (6 * pieces.size());
+    vector<int8_t> results(count, OPEN);
+    vector<int16_t> distances(count, 0);
+    atomic<bool> missingTable{false};
+
+    // Children in this table are read while other threads write, hence the relaxed atomic accesses
+    auto load = [](const auto& values, size_t index) {
+        using Value = typename decay_t<decltype(values)>::value_type;
+        return atomic_ref<Value>(const_cast<Value&>(values[index])).load(memory_order_relaxed);
+    };
+    auto store = [](auto& values, size_t index, auto value) {
+        using Value = typename decay_t<decltype(values)>::value_type;
+        atomic_ref<Value>(values[index]).store((Value)value, memory_order_relaxed);
+    };
+
+    // Result for the side to move in pos, just reached by move: from this table while the material stays
+    // the same, else from the smaller tables. A double push may allow en passant, which the table ignores
+    auto childResult = [&](Position& pos, Move move) -> int {
+        ProbeState state;
+        if (isCaptureMove(move) || isPromotionMove(move)) {
+            int wdl = probeWdl(pos, state);
+            if (state == PROBE_FAIL) missingTable = true;
+            return state == PROBE_FAIL ? OPEN : wdl;
+        }
+        int result = load(results, solverIndex(pieces, pos));
+        if (moveFlags(move) != DOUBLE_PAWN_PUSH || !pos.enPassantTarget) return result;
+        MoveList replies;
+        generateMoves(pos, replies);
+        for (Move reply : replies) {
+            if (moveFlags(reply) != EN_PASSANT) continue;
+            makeMove(pos, reply);
+            int capture = -probeWdl(pos, state);
+            undoMove(pos);
+            if (state == PROBE_FAIL) missingTable = true;
+            else if (result != OPEN || capture == WDL_WIN) result = result == OPEN ? capture : max(result, capture);
+        }
+        return result;
+    };
+
+    // Pass 0: legality, mates and stalemates
+    forEachTableIndex(count, [&](Position& pos, size_t index) -> size_t {
+        if (!solverPosition(pieces, index, pos)) {
+            results[index] = ILLEGAL;
+            return 0;
+        }
+        MoveList moves;
+        generateMoves(pos, moves);
+        if (moves.size() == 0) results[index] = isInCheck(pos) ? WDL_LOSS : WDL_DRAW;
+        return 0;
+    });
+
+    while (forEachTableIndex(count, [&](Position& pos, size_t index) -> size_t {
+        if (load(results, index) != OPEN) return 0;
+        solverPosition(pieces, index, pos);
+        MoveList moves;
+        generateMoves(pos, moves);
+        bool allWon = true;
+        for (Move move : moves) {
+            makeMove(pos, move);
+            int child = childResult(pos, move);
+            undoMove(pos);
+            if (child == WDL_LOSS) {
+                store(results, index, WDL_WIN);
+                return 1;
+            }
+            allWon = allWon && child == WDL_WIN;
+        }
+        if (!allWon) return 0;
+        store(results, index, WDL_LOSS);
+        return 1;
+    })) {}
+    for (int8_t& result : results) {
+        if (result == OPEN) result = WDL_DRAW;
+    }
+
+    // Distances: pass k finds the wins whose fastest zeroing move (or mate) is k plies away. A loss is
+    // settled once every reply's distance is known; a capture or pawn move counts one ply
+    int idlePasses = 0;
+    for (int plies = 1; plies < 1000 && idlePasses < 2; ++plies) {
+        size_t settled = forEachTableIndex(count, [&](Position& pos, size_t index) -> size_t {
+            int result = results[index];
+            if ((result != WDL_WIN && result != WDL_LOSS) || load(distances, index) != 0) return 0;
+            solverPosition(pieces, index, pos);
+            MoveList moves;
+            generateMoves(pos, moves);
+            int longest = 1;
+            for (Move move : moves) {
+                bool zeroing = isCaptureMove(move) || isPawnMove(pos, move);
+                makeMove(pos, move);
+                int distance = 0;
+                bool winning = false;
+                if (zeroing) {
+                    winning = result == WDL_WIN && plies == 1 && childResult(pos, move) == WDL_LOSS;
+                } else {
+                    size_t child = solverIndex(pieces, pos);
+                    distance = load(distances, child);
+                    winning = result == WDL_WIN && results[child] == WDL_LOSS &&
+                              (plies == 1 ? isCheckmate(pos) : -distance == plies - 1);
+                }
+                undoMove(pos);
+                if (winning) {
+                    store(distances, index, plies);
+                    return 1;
+                }
+                if (result == WDL_LOSS && !zeroing) {
+                    if (distance == 0) return 0;
+                    longest = max(longest, distance + 1);
+                }
+            }
+            if (result != WDL_LOSS) return 0;
+            store(distances, index, -longest);
+            return 1;
+        });
+        idlePasses = settled ? 0 : idlePasses + 1;
+    }
+    if (missingTable) {
+        cout << table.name << ": a smaller table is missing\n";
+        return false;
+    }
+    return writeTablebaseFile(table, false, pieces, results, distances, directory + "/" + table.name + ".rtbw") &&
+           writeTablebaseFile(table, true, pieces, results, distances, directory + "/" + table.name + ".rtbz");
+}
+
+// Generate every missing table with up to maxPieces men into the tablebase directory, smaller tables
+// first so captures and promotions always lead into tables that already exist
+bool generateTablebases(const string& directory, int maxPieces) {
+    mkdir(directory.c_str(), 0755); // Fine if it already exists
+    initializeTablebases(directory);
+
+    // Each side's extra pieces as a string over "QRBNP", strongest first
+    vector<string> sides = {""};
+    for (size_t i = 0; i < sides.size(); ++i) {
+        if ((int)sides[i].size() == maxPieces - 2) continue;
+        for (char c : string("QRBNP").substr(sides[i].empty() ? 0 : string("QRBNP").find(sides[i].back()))) {
+            sides.push_back(sides[i] + c);
+        }
+    }
+    auto stronger = [](const string& a, const string& b) {
+        if (a.size() != b.size()) return a.size() > b.size();
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i] != b[i]) return string("QRBNP").find(a[i]) < string("QRBNP").find(b[i]);
+        }
+        return true;
+    };
+    vector<string> names;
+    for (const string& white : sides) {
+        for (const string& black : sides) {
+            int men = (int)(white.size() + black.size()) + 2;
+            if (men > 2 && men <= maxPieces && stronger(white, black)) names.push_back("K" + white + "vK" + black);
+        }
+    }
+    auto order = [](const string& name) {
+        return make_pair(name.size(), count(name.begin(), name.end(), 'P'));
+    };
+    stable_sort(names.begin(), names.end(), [&](const string& a, const string& b) { return order(a) < order(b); });
+
+    bool hadNetwork = useNnue;
+    useNnue = false; // Accumulators are not needed to walk the move tree
+    for (const string& name : names) {
+        Tablebase described;
+        describeTablebase(name, described);
+        if (tablebases.count(described.key)) continue;
+        auto start = chrono::steady_clock::now();
+        if (!generateTablebase(described, directory)) {
+            cout << "Could not write " << directory << "/" << name << ".rtbw\n";
+            useNnue = hadNetwork;
+            return false;
+        }
+        Tablebase& table = tablebases[described.key];
+        describeTablebase(name, table);
+        table.wdl.path = directory + "/" + name + ".rtbw";
+        table.dtz.path = directory + "/" + name + ".rtbz";
+        cout << name << "  time " << (int64_t)(secondsSince(start) * 1000) << " ms\n";
+    }
+    useNnue = hadNetwork;
+    return true;
+}
+
+// A position with its result from the WDL tables and its DTZ
+struct KnownResult {
+    const char* fen;
+    int wdl;
+    int dtz; // 0 to check only the sign
+};
+
+// Probe each position and report those whose WDL or DTZ differ from the known ones
+bool checkKnownResults(const vector<KnownResult>& knownResults) {
+    bool ok = true;
+    Position pos;
+    for (const KnownResult& known : knownResults) {
+        setPositionFromFEN(pos, known.fen);
+        ProbeState wdlState, dtzState;
+        int wdl = probeWdl(pos, wdlState), dtz = probeDtz(pos, dtzState);
+        bool signMatches = (dtz > 0) == (known.wdl > 0) && (dtz < 0) == (known.wdl < 0);
+        if (wdlState == PROBE_FAIL || dtzState == PROBE_FAIL || wdl != known.wdl || !signMatches ||
+            (known.dtz && dtz != known.dtz)) {
+            cout << known.fen << ": expected " << known.wdl << " with DTZ " << known.dtz << ", got " << wdl << " with DTZ "
+                 << dtz << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Wins, draws and losses by probing every position of the tables with up to TB_GENERATE_MAX_PIECES men,
+// plus a few positions with known results. Returns false if WDL and DTZ disagree, or anything disagrees
+// with established endgame theory
+bool runTablebaseCheck() {
+    bool ok = true;
+    map<string, int> longestWins;
+    for (auto& [key, table] : tablebases) {
+        if (table.pieceCount > TB_GENERATE_MAX_PIECES) continue;
+        vector<int> pieces = tablebasePieces(table.name);
+        atomic<size_t> wins{0}, draws{0}, losses{0}, failures{0};
+        atomic<int> longest{0};
+        forEachTableIndex((size_t)2 << (6 * pieces.size()), [&](Position& pos, size_t index) -> size_t {
+            if (!solverPosition(pieces, index, pos)) return 0;
+            ProbeState wdlState, dtzState;
+            int wdl = probeWdl(pos, wdlState), dtz = probeDtz(pos, dtzState);
+            if (wdlState == PROBE_FAIL || dtzState == PROBE_FAIL || (wdl > 0) != (dtz > 0) || (wdl < 0) != (dtz < 0)) {
+                failures++;
+                return 0;
+            }
+            (wdl > 0 ? wins : wdl < 0 ? losses : draws)++;
+            for (int seen = longest.load(); dtz > seen && !longest.compare_exchange_weak(seen, dtz);) {}
+            return 0;
+        });
+        longestWins[table.name] = longest;
+        cout << table.name << "  wins " << wins << "  draws " << draws << "  losses " << losses << "  longest win "
+             << longest << " plies to zeroing" << (failures ? "  unreadable or inconsistent " + to_string(failures) : "")
+             << "\n";
+        ok = ok && failures == 0;
+    }
+
+    // Mate in 10 and 16 moves are the longest in KQ v K and KR v K; lone minor pieces never win
+    for (auto [name, plies] : {pair<string, int>{"KQvK", 19}, {"KRvK", 31}, {"KBvK", 0}, {"KNvK", 0}}) {
+        if (!longestWins.count(name) || longestWins[name] != plies) {
+            cout << name << ": expected a longest win of " << plies << " plies\n";
+            ok = false;
+        }
+    }
+
+    const vector<KnownResult> knownResults = {
+        {"7k/8/6K1/8/8/8/8/5Q2 w - - 0 1", WDL_WIN, 1},   // Qf8#
+        {"5q2/8/8/8/8/6k1/8/7K b - - 0 1", WDL_WIN, 1},   // The same with colors reversed
+        {"7k/8/6K1/8/8/8/8/5Q2 b - - 0 1", WDL_LOSS, -4}, // Kg8 Qf7+ Kh8 Qf8#
+        {"k7/8/8/8/8/8/P7/K7 w - - 0 1", WDL_DRAW, 0},    // Rook pawn against the cornered king
+        {"4k3/8/4K3/4P3/8/8/8/8 b - - 0 1", WDL_LOSS, 0},
+        {"8/8/8/8/8/4k3/4P3/4K3 w - - 0 1", WDL_DRAW, 0}, // The defender holds the opposition
+        {"8/8/8/8/8/4k3/8/4K3 w - - 0 1", WDL_DRAW, 0},   // Bare kings need no file
+    };
+    ok = checkKnownResults(knownResults) && ok;
+    cout << (ok ? "Tablebases agree with known results\n" : "Tablebases disagree with known results\n");
+    return ok;
+}
+
+const int TB_FIXTURES_MISSING = 77; // Exit code of tb-fixture-check without its tables; CTest reports a skip
+
+// Probe published Syzygy tables, not ones this engine generated, at three to five men. Returns 0 if all
+// agree with the published WDL and DTZ, TB_FIXTURES_MISSING if a table is not under --tb-path, else 1
+int runTablebaseFixtureCheck() {
+    const vector<KnownResult> knownResults = {
+        {"7k/8/6K1/8/8/8/8/5Q2 w - - 0 1", WDL_WIN, 1},       // KQvK: Qf8#
+        {"7k/8/6K1/8/8/8/8/5Q2 b - - 0 1", WDL_LOSS, -4},     // KQvK: Kg8 Qf7+ Kh8 Qf8#
+        {"4k3/8/4K3/4P3/8/8/8/8 b - - 0 1", WDL_LOSS, -4},    // KPvK: Kd8 Kf7 Kd7 e6
+        {"8/8/8/8/8/4k3/4P3/4K3 w - - 0 1", WDL_DRAW, 0},     // KPvK: the defender holds the opposition
+        {"k7/8/1K6/8/8/8/7r/2Q5 w - - 0 1", WDL_WIN, 1},      // KQvKR: Qc8#
+        {"k7/8/1K6/8/8/8/8/1BN5 w - - 0 1", WDL_WIN, 0},      // KBNvK
+        {"8/8/2b5/4k3/8/8/8/2B1K3 w - - 0 1", WDL_DRAW, 0},   // KBvKB
+        {"k7/8/1K6/7n/8/8/7r/2Q5 w - - 0 1", WDL_WIN, 1},     // KQvKRN: Qc8# still
+        {"1K1k4/1P6/8/8/8/8/r7/2R5 w - - 0 1", WDL_WIN, 0},   // KRPvKR: the Lucena position
+        {"7b/8/4k3/8/4P3/8/3K4/1B6 w - - 0 1", WDL_DRAW, 0},  // KBPvKB: opposite bishops, the king blockades
+    };
+    Position pos;
+    bool complete = true;
+    for (const KnownResult& known : knownResults) {
+        setPositionFromFEN(pos, known.fen);
+        Tablebase* table = findTablebase(pos);
+        if (!table || table->dtz.path.empty()) {
+            cout << known.fen << ": no WDL and DTZ tables under " << tablebasePath << "\n";
+            complete = false;
+        }
+    }
+    if (!complete) return TB_FIXTURES_MISSING;
+    bool ok = checkKnownResults(knownResults);
+    cout << (ok ? "Syzygy fixtures agree with published results\n" : "Syzygy fixtures disagree with published results\n");
+    return ok ? 0 : 1;
+}
+
+
+
+// Bound type of a stored score relative to the true minimax value
+enum Bound : uint8_t {
+    BOUND_NONE = 0,
+    BOUND_UPPER = 1, // Search failed low: true value <= score
+    BOUND_LOWER = 2, // Search failed high: true value >= score
+    BOUND_EXACT = 3
+};
+
+// One 16-byte transposition slot. The key is stored XORed with the data word, so a slot torn by two
+// threads writing at once no longer matches its key and is ignored; no locks are needed
+struct TTEntry {
+    uint64_t key;  // Zobrist key ^ data
+    uint64_t data; // Bits 0-15 score, 16-31 best move, 32-39 depth, 40-41 bound, 42-47 generation
+
+    int score() const { return (int16_t)(data & 0xFFFF); }
+    Move move() const { return (Move)(data >> 16); }
+    int depth() const { return (int)((data >> 32) & 0xFF); }
+    int bound() const { return (int)((data >> 40) & 3); }
+    int generation() const { return (int)((data >> 42) & 63); }
+};
+
+// Relaxed atomic access to shared entries: plain loads and stores on x86, but free of data races
+inline uint64_t loadRelaxed(const uint64_t& word) {
+    return atomic_ref<uint64_t>(const_cast<uint64_t&>(word)).load(memory_order_relaxed);
+}
+
+inline void storeRelaxed(uint64_t& word, uint64_t value) {
+    atomic_ref<uint64_t>(word).store(value, memory_order_relaxed);
+}
+
+// Snapshot of one slot, with the key recovered from the XORed form
+inline TTEntry loadEntry(const TTEntry& entry) {
+    uint64_t data = loadRelaxed(entry.data);
+    return {loadRelaxed(entry.key) ^ data, data};
+}
+
+// Four entries fill exactly one cache line, so a probe touches a single line
+struct alignas(64) TTBucket {
+    TTEntry entries[4];
+};
+
+// Fixed-size transposition table with a power-of-two number of buckets
+struct TranspositionTable {
+    vector<TTBucket> buckets;
+    uint64_t mask = 0;
+    int generation = 0;
+
+    // Use the largest power-of-two bucket count that fits in the given number of megabytes, halving it
+    // for as long as that much memory cannot be had. Returns the megabytes actually used
+    size_t resize(size_t megabytes) {
+        size_t count = 1;
+        while (count * 2 * sizeof(TTBucket) <= max<size_t>(megabytes, 1) * 1024 * 1024) count *= 2;
+        buckets = vector<TTBucket>(); // Release the old table before allocating the new one
+        while (true) {
+            try {
+                buckets.assign(count, TTBucket{});
+                break;
+            } catch (const bad_alloc&) {
+                if (count == 1) throw;
+                count /= 2;
+            }
+        }
+        mask = count - 1;
+        generation = 0;
+        return count * sizeof(TTBucket) / (1024 * 1024);
+    }
+
+    void clear() {
+        fill(buckets.begin(), buckets.end(), TTBucket{});
+        generation = 0;
+    }
+
+    // Called once per search so entries from older searches become preferred replacement victims
+    void newSearch() {
+        generation = (generation + 1) & 63;
+    }
+
+    void prefetch(uint64_t key) const {
+        __builtin_prefetch(&buckets[key & mask]);
+    }
+
+    bool probe(uint64_t key, TTEntry& result) const {
+        const TTBucket& bucket = buckets[key & mask];
+        for (const TTEntry& slot : bucket.entries) {
+            TTEntry entry = loadEntry(slot);
+            if (entry.key == key && entry.bound() != BOUND_NONE) {
+                result = entry;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Replace the same position if present, otherwise the shallowest entry, counting older searches as shallower
+    void store(uint64_t key, int score, Move move, int depth, int bound) {
+        TTBucket& bucket = buckets[key & mask];
+        TTEntry* victim = &bucket.entries[0];
+        TTEntry victimEntry = loadEntry(*victim);
+        int victimWorth = numeric_limits<int>::max();
+
+        for (TTEntry& slot : bucket.entries) {
+            TTEntry entry = loadEntry(slot);
+            if (entry.key == key || entry.bound() == BOUND_NONE) {
+                victim = &slot;
+                victimEntry = entry;
+                break;
+            }
+            int age = (generation - entry.generation()) & 63;
+            int worth = entry.depth() - 8 * age;
+            if (worth < victimWorth) {
+                victim = &slot;
+                victimEntry = entry;
+                victimWorth = worth;
+            }
+        }
+
+        // Keep the old best move when this search did not produce one
+        if (move == NULL_MOVE && victimEntry.key == key) move = victimEntry.move();
+
+        uint64_t data = (uint64_t)(uint16_t)(int16_t)score |
+                        ((uint64_t)move << 16) |
+                        ((uint64_t)(uint8_t)min(max(depth, 0), 255) << 32) |
+                        ((uint64_t)bound << 40) |
+                        ((uint64_t)generation << 42);
+        storeRelaxed(victim->key, key ^ data);
+        storeRelaxed(victim->data, data);
+    }
+
+    // Permille of sampled entries written during the current search
+    int hashfull() const {
+        int sampled = 0, used = 0;
+        for (size_t i = 0; i < buckets.size() && i < 1000; ++i) {
+            for (const TTEntry& slot : buckets[i].entries) {
+                TTEntry entry = loadEntry(slot);
+                sampled++;
+                if (entry.bound() != BOUND_NONE && entry.generation() == generation) used++;
+            }
+        }
+        return sampled ? used * 1000 / sampled : 0;
+    }
+};
+
+
+
+const int MAX_DEPTH = 64;
+
+// Serializes lines written by the search thread and the UCI input thread
+mutex outputMutex;
+
+void sendLine(const string& line) {
+    LOG(LOG_DEBUG, LOG_IO, "> " << line);
+    lock_guard<mutex> lock(outputMutex);
+    cout << line << endl;
+}
+
+// Search statistics, compiled in with -DCHESS_SEARCH_STATS. Each thread counts into its own SearchStats;
+// findBestMove sums them and writes one JSON line per search. Without the flag SEARCH_STAT discards its
+// argument, so release builds carry no counting code
+#ifdef CHESS_SEARCH_STATS
+#define SEARCH_STAT(statement) statement
+#else
+#define SEARCH_STAT(statement) ((void)0)
+#endif
+
+const int STATS_MAX_PLY = 128; // Deeper quiescence plies are counted in the last slot
+
+struct SearchStats {
+    uint64_t ttProbes = 0;
+    uint64_t ttHits = 0;
+    uint64_t ttCutoffs = 0;            // Nodes answered by a stored bound or exact score
+    uint64_t standPatCutoffs = 0;      // Quiescence nodes whose static evaluation alone failed high
+    uint64_t deltaPruned = 0;          // Quiescence captures skipped by delta pruning
+    uint64_t aspirationFailLows = 0;   // Root re-searches after a score at or below the window
+    uint64_t aspirationFailHighs = 0;  // Root re-searches after a score at or above the window
+    uint64_t nullMoveTries = 0;        // Null-move searches started
+    uint64_t nullMoveCutoffs = 0;      // Null-move searches that failed high and pruned the node
+    uint64_t lmrReductions = 0;        // Moves searched at reduced depth
+    uint64_t lmrResearches = 0;        // Reduced moves that beat alpha and were searched again at full depth
+    uint64_t pvsResearches = 0;        // Zero-window searches that landed inside the window and were searched again
+    uint64_t nodesPerPly[STATS_MAX_PLY] = {};
+    vector<uint64_t> iterationNodes;   // Nodes of each completed iteration, the first one at index 0
+
+    void add(const SearchStats& other) {
+        ttProbes += other.ttProbes;
+        ttHits += other.ttHits;
+        ttCutoffs += other.ttCutoffs;
+        standPatCutoffs += other.standPatCutoffs;
+        deltaPruned += other.deltaPruned;
+        aspirationFailLows += other.aspirationFailLows;
+        aspirationFailHighs += other.aspirationFailHighs;
+        nullMoveTries += other.nullMoveTries;
+        nullMoveCutoffs += other.nullMoveCutoffs;
+        lmrReductions += other.lmrReductions;
+        lmrResearches += other.lmrResearches;
+        pvsResearches += other.pvsResearches;
+        for (int ply = 0; ply < STATS_MAX_PLY; ++ply) nodesPerPly[ply] += other.nodesPerPly[ply];
+    }
+};
+
+// When a search should stop: the deepest iteration to run plus optional node and time budgets
+struct SearchLimits {
+    int depth = 4;
+    uint64_t nodes = 0;   // Nodes searched by the main thread; 0 means no limit
+    int64_t timeMs = 0;   // Wall-clock milliseconds; 0 means no limit
+};
+
+// How a context searches, so two configurations can play each other in one process
+struct SearchOptions {
+    bool classicalEvaluation = false; // Ignore a loaded network
+    bool principalVariationSearch = true; // Zero-window searches for every move after the first
+    bool nullMovePruning = true;
+    bool lateMoveReductions = true;
+};
+
+// Shared state of one search: the transposition table and the controls every search thread watches.
+// Each game owns one, sized to suit however many games the process runs at once
+struct SearchContext {
+    TranspositionTable transpositionTable;
+    int threads = 1;
+    atomic<bool> stopped{false};
+    atomic<bool> stopRequested{false}; // Set from outside the search (UCI stop); the main thread turns it into stopped
+    atomic<bool> pondering{false};     // Searching on the opponent's time: the time budget is not running yet
+    atomic<int64_t> timeBudgetStartMs{0}; // Milliseconds after startTime at which the time budget started
+    SearchLimits limits;
+    SearchOptions options;
+    chrono::steady_clock::time_point startTime;
+    bool uciOutput = false;            // Report progress as UCI info lines
+    chrono::steady_clock::time_point lastInfoTime;
+    uint64_t lastSearchNodes = 0;  // Nodes of the last findBestMove call, summed over all threads
+    uint64_t lastSearchQNodes = 0; // The part of lastSearchNodes spent in quiescence search
+    uint64_t lastSearchTbHits = 0; // Tablebase probes that found the position, all threads and the root
+    int lastSearchDepth = 0;       // Depth of the iteration findBestMove returned
+    vector<PawnHashTable> pawnTables; // One per search thread, kept between searches
+
+    explicit SearchContext(size_t hashMegabytes = 16) {
+        transpositionTable.resize(hashMegabytes);
+    }
+};
+
+// One search thread: the position it searches (its own copy for Lazy SMP helpers) and its counters
+struct SearchWorker {
+    Position& pos;
+    SearchContext& context;
+    PawnHashTable& pawnTable;
+    bool isMainThread = false; // Only the main thread enforces the node and time budgets
+    uint64_t nodes = 0;        // All nodes, quiescence included
+    uint64_t qnodes = 0;       // Nodes visited by the quiescence search
+    uint64_t cutoffs = 0;      // Beta cutoffs in negamax
+    uint64_t firstMoveCutoffs = 0; // Cutoffs caused by the first legal move tried
+    uint64_t tbHits = 0;       // Positions scored by the endgame tablebases
+#ifdef CHESS_SEARCH_STATS
+    SearchStats stats{};
+#endif
+    int rootPly = pos.gamePly; // Game ply of the root, so pos.gamePly - rootPly is the search ply
+
+    Move killers[MAX_DEPTH + 1][2] = {}; // Two most recent quiet cutoff moves at each search ply
+    int history[2][64][64] = {};         // Butterfly history of quiet cutoffs, by side to move, from and to
+};
+
+// Stop every thread once the main thread has used up its node or time budget or a stop was requested.
+// In UCI mode this is also where a progress line goes out about once a second
+inline void checkLimits(SearchWorker& worker) {
+    SearchContext& context = worker.context;
+    const SearchLimits& limits = context.limits;
+    if (!worker.isMainThread) return;
+    if (context.stopRequested.load(memory_order_relaxed)) context.stopped = true;
+    if (limits.nodes && worker.nodes >= limits.nodes) context.stopped = true;
+    if ((worker.nodes & 1023) != 0) return;
+
+    auto now = chrono::steady_clock::now();
+    if (limits.timeMs && !context.pondering.load(memory_order_acquire) &&
+        now - context.startTime >= chrono::milliseconds(context.timeBudgetStartMs.load(memory_order_relaxed) + limits.timeMs)) {
+        context.stopped = true;
+    }
+    if (context.uciOutput && now - context.lastInfoTime >= chrono::seconds(1)) {
+        context.lastInfoTime = now;
+        int64_t ms = max((int64_t)chrono::duration_cast<chrono::milliseconds>(now - context.startTime).count(), (int64_t)1);
+        sendLine("info nodes " + to_string(worker.nodes) + " nps " + to_string(worker.nodes * 1000 / ms) + " time " +
+                 to_string(ms) + " hashfull " + to_string(context.transpositionTable.hashfull()) + " tbhits " +
+                 to_string(worker.tbHits));
+    }
+}
+
+
+// Define a function to get the maximum evaluation
+int max(int a, int b) {
+    return (a > b) ? a : b;
+}
+
+// Define a function to get the minimum evaluation
+int min(int a, int b) {
+    return (a < b) ? a : b;
+}
+
+// Scores at or beyond this are mates: being mated at search ply p scores -(MATE_SCORE + MAX_DEPTH - p),
+// so nearer mates score further from zero
+const int MATE_SCORE = 30000;
+
+// Bounds every search score, mates included
+const int SCORE_INFINITE = MATE_SCORE + MAX_DEPTH + 1;
+
+// Half-width of the first aspiration window around the previous iteration's score
+const int ASPIRATION_WINDOW = 25;
+
+// Material a capture or promotion wins, not counting any recapture
+int captureGain(const Position& pos, Move move) {
+    int flags = moveFlags(move);
+    int gain = 0;
+    if (flags == EN_PASSANT) gain = PAWN_VALUE;
+    else if (isCaptureMove(move)) gain = PIECE_VALUES[pieceOn(pos, moveTo(move)) % 6];
+    if (isPromotionMove(move)) gain += PIECE_VALUES[1 + (flags & 3)] - PAWN_VALUE;
+    return gain;
+}
+
+// MVV-LVA: most valuable victim first, cheapest attacker first among equal victims
+inline int mvvLva(const Position& pos, Move move) {
+    return captureGain(pos, move) * 8 - pieceOn(pos, moveFrom(move)) % 6;
+}
+
+// Move ordering score bands; each band is tried only after every move of the band above it
+const int HASH_MOVE_SCORE = 1 << 30;
+const int CAPTURE_SCORE = 1 << 28;  // Plus MVV-LVA; promotions count as captures
+const int KILLER_SCORE = 1 << 27;   // Plus one for the most recent killer
+const int HISTORY_MAX = 1 << 20;    // Quiet moves score their history, which is kept below this
+
+// Hands out the moves of one node best first: hash move, captures by MVV-LVA, killers, then quiet
+// moves by history. Every move is scored once up front and picked by partial selection sort, so a
+// cutoff early in the list never pays for ordering the rest
+struct MovePicker {
+    MoveList moves;
+    int scores[256]{};
+    int picked = 0;
+
+    MovePicker(const SearchWorker& worker, Move hashMove) {
+        const Position& pos = worker.pos;
+        int ply = min(pos.gamePly - worker.rootPly, MAX_DEPTH);
+        const Move* killers = worker.killers[ply];
+        const auto& history = worker.history[pos.isWhiteTurn ? 0 : 1];
+
+        generateMoves(pos, moves);
+        for (int i = 0; i < moves.size(); ++i) {
+            Move move = moves[i];
+            if (move == hashMove) scores[i] = HASH_MOVE_SCORE;
+            else if (isCaptureMove(move) || isPromotionMove(move)) scores[i] = CAPTURE_SCORE + mvvLva(pos, move);
+            else if (move == killers[0]) scores[i] = KILLER_SCORE + 1;
+            else if (move == killers[1]) scores[i] = KILLER_SCORE;
+            else scores[i] = history[moveFrom(move)][moveTo(move)];
+        }
+    }
+
+    // Next best move, or NULL_MOVE when every move has been handed out
+    Move next() {
+        if (picked == moves.size()) return NULL_MOVE;
+        int best = picked;
+        for (int i = picked + 1; i < moves.size(); ++i) {
+            if (scores[i] > scores[best]) best = i;
+        }
+        swap(moves[picked], moves[best]);
+        swap(scores[picked], scores[best]);
+        return moves[picked++];
+    }
+};
+
+// Remember a quiet move that caused a beta cutoff: as a killer for this ply and in the history table
+void updateQuietCutoff(SearchWorker& worker, Move move, int depth) {
+    int ply = min(worker.pos.gamePly - worker.rootPly, MAX_DEPTH);
+    Move* killers = worker.killers[ply];
+    if (killers[0] != move) {
+        killers[1] = killers[0];
+        killers[0] = move;
+    }
+
+    auto& history = worker.history[worker.pos.isWhiteTurn ? 0 : 1];
+    int& entry = history[moveFrom(move)][moveTo(move)];
+    entry += depth * depth;
+    if (entry >= HISTORY_MAX) {
+        // Halve everything so recent cutoffs keep outweighing old ones
+        for (auto& fromRow : history) {
+            for (int& value : fromRow) value /= 2;
+        }
+    }
+}
+
+// Captures whose material gain cannot lift the stand-pat score this close to alpha are skipped
+const int DELTA_MARGIN = 200;
+
+// Null-move pruning is tried from this depth, with the reply searched R = 2 plies shallower, or 3 above
+// NULL_MOVE_DEEP_DEPTH (adaptive null move)
+const int NULL_MOVE_MIN_DEPTH = 3;
+const int NULL_MOVE_DEEP_DEPTH = 6;
+
+// Late move reductions apply from this depth to quiet moves after the first LMR_MIN_MOVES
+const int LMR_MIN_DEPTH = 3;
+const int LMR_MIN_MOVES = 3;
+int lateMoveReductions[MAX_DEPTH + 1][64]; // By depth and move number, growing with the log of each
+
+void initializeLateMoveReductions() {
+    for (int depth = 1; depth <= MAX_DEPTH; ++depth) {
+        for (int moveNumber = 1; moveNumber < 64; ++moveNumber) {
+            lateMoveReductions[depth][moveNumber] = (int)(0.75 + log(depth) * log(moveNumber) / 2.25);
+        }
+    }
+}
+
+// Static evaluation from the side to move's point of view
+inline int staticEvaluation(SearchWorker& worker) {
+    int eval = evaluatePosition(worker.pos, &worker.pawnTable, !worker.context.options.classicalEvaluation);
+    return worker.pos.isWhiteTurn ? eval : -eval;
+}
+
+// Whether the side to move has a piece other than pawns; without one, zugzwang makes passing unsafe
+inline bool hasNonPawnMaterial(const Position& pos) {
+    const uint64_t* own = pos.bitboards + (pos.isWhiteTurn ? WHITE_PAWN : BLACK_PAWN);
+    return (own[1] | own[2] | own[3] | own[4]) != 0;
+}
+
+// Mate and tablebase win scores are stored relative to the node rather than the root, so they stay
+// right wherever the entry is found again
+const int DISTANCE_SCORE = TB_WIN_SCORE - MAX_GAME_PLY; // Scores beyond this count plies from the root
+
+inline int scoreToTable(int score, int ply) {
+    return score >= DISTANCE_SCORE ? score + ply : (score <= -DISTANCE_SCORE ? score - ply : score);
+}
+
+inline int scoreFromTable(int score, int ply) {
+    return score >= DISTANCE_SCORE ? score - ply : (score <= -DISTANCE_SCORE ? score + ply : score);
+}
+
+// Search captures and promotions only, until the position is quiet, so leaf scores are not taken
+// in the middle of an exchange. The side to move may always stand pat on the static evaluation.
+// Checks are not detected here, so a position that is mate can still be scored by its material.
+// Scores are from the side to move's point of view
+int quiescence(SearchWorker& worker, int alpha, int beta) {
+    Position& pos = worker.pos;
+    worker.nodes++;
+    worker.qnodes++;
+    SEARCH_STAT(worker.stats.nodesPerPly[min(pos.gamePly - worker.rootPly, STATS_MAX_PLY - 1)]++);
+    checkLimits(worker);
+    if (worker.context.stopped.load(memory_order_relaxed)) return 0; // Result is discarded by the caller
+
+    int standPat = staticEvaluation(worker);
+    if (standPat >= beta) {
+        SEARCH_STAT(worker.stats.standPatCutoffs++);
+        return standPat;
+    }
+    alpha = max(alpha, standPat);
+
+    MoveList moves;
+    generateMoves(pos, moves);
+    pair<int, Move> tactical[256];
+    int count = 0;
+    for (Move move : moves) {
+        if (!isCaptureMove(move) && !isPromotionMove(move)) continue;
+        if (standPat + captureGain(pos, move) + DELTA_MARGIN <= alpha) {
+            SEARCH_STAT(worker.stats.deltaPruned++);
+            continue; // Delta pruning
+        }
+        tactical[count++] = {mvvLva(pos, move), move};
+    }
+    sort(tactical, tactical + count, [](const pair<int, Move>& a, const pair<int, Move>& b) { return a.first > b.first; });
+
+    int bestEval = standPat;
+    for (int i = 0; i < count; ++i) {
+        makeMove(pos, tactical[i].second);
+        int eval = -quiescence(worker, -beta, -alpha);
+        undoMove(pos);
+        if (worker.context.stopped.load(memory_order_relaxed)) return 0;
+
+        bestEval = max(bestEval, eval);
+        alpha = max(alpha, eval);
+        if (alpha >= beta) break;
+    }
+    return bestEval;
+}
+
+// Negamax alpha-beta search with scores from the side to move's point of view. With principal variation
+// search only the first move gets the full window; the rest are searched with a zero window that merely
+// proves them no better than alpha, and searched again in full only if that proof fails. Null-move pruning
+// and late move reductions make those zero-window searches cheaper still
+int negamax(SearchWorker& worker, int depth, int alpha, int beta) {
+    Position& pos = worker.pos;
+    const SearchOptions& options = worker.context.options;
+    TranspositionTable& transpositionTable = worker.context.transpositionTable;
+
+    // Base case: resolve captures before trusting the evaluation
+    if (depth <= 0) return quiescence(worker, alpha, beta);
+
+    int ply = pos.gamePly - worker.rootPly;
+    worker.nodes++;
+    SEARCH_STAT(worker.stats.nodesPerPly[min(ply, STATS_MAX_PLY - 1)]++);
+    checkLimits(worker);
+    if (worker.context.stopped.load(memory_order_relaxed)) return 0; // Result is discarded by the caller
+
+    // Exact result from the tablebases, trusted only right after a capture or pawn move and without
+    // castling rights, as the tables assume both. Nearer wins score higher, like nearer mates
+    if (pos.halfmoveClock == 0 && !pos.castlingRights && __builtin_popcountll(pos.allPieces) <= tablebaseProbeLimit &&
+        !tablebases.empty()) {
+        ProbeState state;
+        int wdl = probeWdl(pos, state);
+        if (state != PROBE_FAIL) {
+            worker.tbHits++;
+            return wdl > WDL_CURSED_WIN ? TB_WIN_SCORE - ply : wdl < WDL_BLESSED_LOSS ? -TB_WIN_SCORE + ply : 0;
+        }
+    }
+
+    uint64_t zobristHash = pos.hash(); // Retrieve current Zobrist hash
+    int alphaOriginal = alpha;
+    bool isPvNode = beta - alpha > 1;
+    Move hashMove = NULL_MOVE;
+
+    // Check transposition table
+    TTEntry entry;
+    SEARCH_STAT(worker.stats.ttProbes++);
+    if (transpositionTable.probe(zobristHash, entry)) {
+        SEARCH_STAT(worker.stats.ttHits++);
+        hashMove = entry.move();
+        if (entry.depth() >= depth) {
+            int storedEval = scoreFromTable(entry.score(), ply);
+            if (entry.bound() == BOUND_EXACT ||
+                (entry.bound() == BOUND_LOWER && storedEval >= beta) ||
+                (entry.bound() == BOUND_UPPER && storedEval <= alpha)) {
+                SEARCH_STAT(worker.stats.ttCutoffs++);
+                return storedEval; // Use cached evaluation
+            }
+        }
+    }
+
+    bool inCheck = isInCheck(pos);
+
+    // Null-move pruning: if passing still fails high at reduced depth, a real move would too. Not twice
+    // in a row, and not without pieces, where zugzwang makes passing better than any move
+    bool afterNullMove = pos.gamePly > 0 && pos.undoStack[pos.gamePly - 1].move == NULL_MOVE;
+    if (options.nullMovePruning && !isPvNode && !inCheck && !afterNullMove && depth >= NULL_MOVE_MIN_DEPTH &&
+        abs(beta) < DISTANCE_SCORE && hasNonPawnMaterial(pos) && staticEvaluation(worker) >= beta) {
+        int reduction = depth > NULL_MOVE_DEEP_DEPTH ? 3 : 2;
+        SEARCH_STAT(worker.stats.nullMoveTries++);
+        makeNullMove(pos);
+        int eval = -negamax(worker, depth - 1 - reduction, -beta, -beta + 1);
+        undoNullMove(pos);
+        if (worker.context.stopped.load(memory_order_relaxed)) return 0;
+        if (eval >= beta) {
+            SEARCH_STAT(worker.stats.nullMoveCutoffs++);
+            return beta; // Not eval, which may be an unproven mate
+        }
+    }
+
+    MovePicker picker(worker, hashMove);
+
+    // No legal moves: checkmate (nearer mates score lower) or stalemate
+    if (picker.moves.size() == 0) return inCheck ? -MATE_SCORE - (MAX_DEPTH - ply) : 0;
+
+    const Move* killers = worker.killers[min(ply, MAX_DEPTH)];
+    int bestEval = -SCORE_INFINITE;
+    Move bestMove = NULL_MOVE;
+    int movesTried = 0;
+
+    for (Move move = picker.next(); move != NULL_MOVE; move = picker.next()) {
+        bool isQuiet = !isCaptureMove(move) && !isPromotionMove(move);
+        bool isKiller = move == killers[0] || move == killers[1];
+        makeMove(pos, move);
+        movesTried++;
+        transpositionTable.prefetch(pos.hash()); // Child bucket loads while we recurse
+
+        // Late quiet moves rarely matter, so they are first searched shallower, and again at full depth
+        // only if they beat alpha. Checks in either direction are never reduced
+        int reduction = 0;
+        if (options.lateMoveReductions && depth >= LMR_MIN_DEPTH && movesTried > LMR_MIN_MOVES && isQuiet && !isKiller &&
+            !inCheck && !isInCheck(pos)) {
+            reduction = lateMoveReductions[min(depth, MAX_DEPTH)][min(movesTried, 63)] - (isPvNode ? 1 : 0);
+            reduction = max(min(reduction, depth - 2), 0);
+            SEARCH_STAT(if (reduction) worker.stats.lmrReductions++);
+        }
+
+        // Principal variation search: every move after the first only has to be proven no better than alpha
+        int searchBeta = options.principalVariationSearch && movesTried > 1 ? alpha + 1 : beta;
+        int eval = -negamax(worker, depth - 1 - reduction, -searchBeta, -alpha);
+        if (reduction && eval > alpha) {
+            SEARCH_STAT(worker.stats.lmrResearches++);
+            eval = -negamax(worker, depth - 1, -searchBeta, -alpha);
+        }
+        if (searchBeta < beta && eval > alpha && eval < beta) {
+            SEARCH_STAT(worker.stats.pvsResearches++);
+            eval = -negamax(worker, depth - 1, -beta, -alpha);
+        }
+
+        undoMove(pos);
+        if (worker.context.stopped.load(memory_order_relaxed)) return 0; // Don't store a partial result
+
+        if (eval > bestEval) {
+            bestEval = eval;
+            bestMove = move;
+        }
+        alpha = max(alpha, eval);
+        if (alpha >= beta) {
+            // Beta cutoff
+            worker.cutoffs++;
+            if (movesTried == 1) worker.firstMoveCutoffs++;
+            if (isQuiet) updateQuietCutoff(worker, move, depth);
+            break;
+        }
+    }
+
+    // Store result in transposition table, with the bound implied by the original window
+    int bound = bestEval <= alphaOriginal ? BOUND_UPPER : (bestEval >= beta ? BOUND_LOWER : BOUND_EXACT);
+    transpositionTable.store(zobristHash, scoreToTable(bestEval, ply), bestMove, depth, bound);
+
+    return bestEval;
+}
+
+struct SearchResult {
+    Move move;
+    int evaluation; // From White's point of view
+};
+
+// Search the root moves to the given depth inside (alpha, beta), both from White's point of view. A score
+// at or outside the window is only a bound. Returns false if the search was stopped before it finished
+bool searchRoot(SearchWorker& worker, const MoveList& rootMoves, int depth, int alpha, int beta, SearchResult& result) {
+    Position& pos = worker.pos;
+    int sign = pos.isWhiteTurn ? 1 : -1;
+    if (sign < 0) {
+        swap(alpha, beta);
+        alpha = -alpha;
+        beta = -beta;
+    }
+    int alphaOriginal = alpha, betaOriginal = beta;
+    SearchResult bestMove = {NULL_MOVE, -SCORE_INFINITE};
+    int movesTried = 0;
+
+    for (Move move : rootMoves) {
+        makeMove(pos, move);
+        movesTried++;
+        int searchBeta = worker.context.options.principalVariationSearch && movesTried > 1 ? alpha + 1 : beta;
+        int eval = -negamax(worker, depth - 1, -searchBeta, -alpha);
+        if (searchBeta < beta && eval > alpha && eval < beta) {
+            SEARCH_STAT(worker.stats.pvsResearches++);
+            eval = -negamax(worker, depth - 1, -beta, -alpha);
+        }
+        undoMove(pos);
+        if (worker.context.stopped.load(memory_order_relaxed)) return false;
+
+        if (eval > bestMove.evaluation) bestMove = {move, eval};
+        alpha = max(alpha, eval);
+        if (alpha >= beta) break;
+    }
+
+    int bound = bestMove.evaluation <= alphaOriginal ? BOUND_UPPER
+              : (bestMove.evaluation >= betaOriginal ? BOUND_LOWER : BOUND_EXACT);
+    worker.context.transpositionTable.store(pos.hash(), bestMove.evaluation, bestMove.move, depth, bound);
+    result = {bestMove.move, sign * bestMove.evaluation};
+    return true;
+}
+
+// The best line stored in the transposition table, starting with the given root move
+string principalVariation(Position& pos, const TranspositionTable& transpositionTable, Move first, int maxLength) {
+    string line;
+    int played = 0;
+    for (Move move = first; move != NULL_MOVE && played < maxLength; ++played) {
+        MoveList moves;
+        generateMoves(pos, moves);
+        if (find(moves.begin(), moves.end(), move) == moves.end()) break; // Hash collision
+        line += (played ? " " : "") + moveToString(move);
+        makeMove(pos, move);
+
+        TTEntry entry;
+        move = transpositionTable.probe(pos.hash(), entry) ? entry.move() : NULL_MOVE;
+    }
+    while (played--) undoMove(pos);
+    return line;
+}
+
+// Centipawns reported for a tablebase win, less its distance from the root in plies
+const int TB_WIN_CP = 10000;
+
+// UCI score for the side to move: centipawns, or moves to mate for a mate score. Tablebase scores
+// are reported on a fixed winning scale rather than as raw TB_WIN_SCORE centipawns
+string uciScore(int evaluation, bool isWhiteTurn) {
+    int score = isWhiteTurn ? evaluation : -evaluation;
+    if (abs(score) < DISTANCE_SCORE) return "cp " + to_string(score);
+    if (abs(score) < MATE_SCORE) {
+        int distance = min(abs(TB_WIN_SCORE - abs(score)), MAX_GAME_PLY);
+        return "cp " + to_string(score > 0 ? TB_WIN_CP - distance : -(TB_WIN_CP - distance));
+    }
+    int plies = max(MAX_DEPTH - (abs(score) - MATE_SCORE), 1); // Mate scores count plies down from MAX_DEPTH
+    return "mate " + to_string(score > 0 ? (plies + 1) / 2 : -(plies + 1) / 2);
+}
+
+void sendIterationInfo(SearchWorker& worker, int depth, const SearchResult& iteration) {
+    SearchContext& context = worker.context;
+    auto now = chrono::steady_clock::now();
+    int64_t ms = max((int64_t)chrono::duration_cast<chrono::milliseconds>(now - context.startTime).count(), (int64_t)1);
+    context.lastInfoTime = now;
+    sendLine("info depth " + to_string(depth) + " score " + uciScore(iteration.evaluation, worker.pos.isWhiteTurn) +
+             " nodes " + to_string(worker.nodes) + " nps " + to_string(worker.nodes * 1000 / ms) + " time " + to_string(ms) +
+             " hashfull " + to_string(context.transpositionTable.hashfull()) + " tbhits " + to_string(worker.tbHits) + " pv " +
+             principalVariation(worker.pos, context.transpositionTable, iteration.move, depth));
+}
+
+// Search depth firstDepth, firstDepth + 1, ... up to maxDepth, each iteration starting with the previous
+// best move and an aspiration window around the previous score that widens whenever the score falls outside it.
+// Leaves the last completed iteration in result and completedDepth (unchanged if none completed)
+void iterativeDeepening(SearchWorker& worker, int firstDepth, int maxDepth, SearchResult& result, int& completedDepth,
+                        bool verbose) {
+    MoveList rootMoves; // Kept in order between iterations
+    generateMoves(worker.pos, rootMoves);
+    if (rootMoves.size() == 0) return;
+
+    for (int depth = firstDepth; depth <= maxDepth; ++depth) {
+        int delta = ASPIRATION_WINDOW;
+        int alpha = -SCORE_INFINITE, beta = SCORE_INFINITE;
+        if (completedDepth > 0 && abs(result.evaluation) < MATE_SCORE) {
+            alpha = max(result.evaluation - delta, -SCORE_INFINITE);
+            beta = min(result.evaluation + delta, SCORE_INFINITE);
+        }
+
+        SearchResult iteration;
+        [[maybe_unused]] uint64_t iterationStartNodes = worker.nodes;
+        while (true) {
+            if (!searchRoot(worker, rootMoves, depth, alpha, beta, iteration)) return;
+            if (iteration.evaluation <= alpha && alpha > -SCORE_INFINITE) {
+                LOG(LOG_DEBUG, LOG_SEARCH, "depth " << depth << " failed low at " << iteration.evaluation);
+                alpha = max(alpha - delta, -SCORE_INFINITE); // Fail low
+                SEARCH_STAT(worker.stats.aspirationFailLows++);
+            } else if (iteration.evaluation >= beta && beta < SCORE_INFINITE) {
+                LOG(LOG_DEBUG, LOG_SEARCH, "depth " << depth << " failed high at " << iteration.evaluation);
+                beta = min(beta + delta, SCORE_INFINITE); // Fail high
+                SEARCH_STAT(worker.stats.aspirationFailHighs++);
+            } else {
+                break;
+            }
+            delta *= 2;
+        }
+
+        result = iteration;
+        completedDepth = depth;
+        LOG(LOG_DEBUG, LOG_SEARCH, (worker.isMainThread ? "main" : "helper") << " depth " << depth << " score "
+                                       << iteration.evaluation << " nodes " << worker.nodes << " move "
+                                       << moveToString(iteration.move));
+        SEARCH_STAT(worker.stats.iterationNodes.push_back(worker.nodes - iterationStartNodes));
+        Move* best = find(rootMoves.begin(), rootMoves.end(), iteration.move);
+        rotate(rootMoves.begin(), best, best + 1);
+
+        if (worker.isMainThread && worker.context.uciOutput) {
+            sendIterationInfo(worker, depth, iteration);
+        } else if (verbose) {
+            double seconds = secondsSince(worker.context.startTime);
+            cout << "depth " << depth << "  score " << iteration.evaluation << "  nodes " << worker.nodes << "  qnodes "
+                 << worker.qnodes << "  first-move cutoffs "
+                 << (worker.cutoffs ? worker.firstMoveCutoffs * 100 / worker.cutoffs : 0) << "%  time "
+                 << (int64_t)(seconds * 1000) << " ms  move " << moveToString(iteration.move) << endl;
+        }
+    }
+}
+
+// What a helper thread managed to finish before the main thread stopped it
+struct HelperResult {
+    int depth = 0;
+    SearchResult result = {NULL_MOVE, 0};
+    uint64_t nodes = 0;
+    uint64_t qnodes = 0;
+    uint64_t tbHits = 0;
+    uint64_t cutoffs = 0;
+    uint64_t firstMoveCutoffs = 0;
+#ifdef CHESS_SEARCH_STATS
+    SearchStats stats{};
+#endif
+};
+
+// Lazy SMP helper thread: search a private copy of the root ever deeper until stopped.
+// Helpers share what they learn with the main thread only through the transposition table
+void helperSearch(Position pos, SearchContext& context, PawnHashTable& pawnTable, int startDepth, HelperResult& out) {
+    SearchWorker worker{pos, context, pawnTable};
+    iterativeDeepening(worker, startDepth, MAX_DEPTH, out.result, out.depth, false);
+    out.nodes = worker.nodes;
+    out.qnodes = worker.qnodes;
+    out.tbHits = worker.tbHits;
+    out.cutoffs = worker.cutoffs;
+    out.firstMoveCutoffs = worker.firstMoveCutoffs;
+#ifdef CHESS_SEARCH_STATS
+    out.stats = worker.stats;
+#endif
+}
+
+// Pick a root move straight from the tablebases by distance to zeroing: the fastest win that the
+// fifty-move rule lets through, else a draw, else the slowest loss. False if castling is still possible
+// or the root or any position after a root move is not covered
+bool tablebaseRootMove(Position& pos, SearchResult& result) {
+    if (tablebases.empty() || pos.castlingRights || __builtin_popcountll(pos.allPieces) > tablebaseProbeLimit) return false;
+    MoveList moves;
+    generateMoves(pos, moves);
+    int bestRank = numeric_limits<int>::min();
+    for (Move move : moves) {
+        bool zeroing = isCaptureMove(move) || isPawnMove(pos, move);
+        makeMove(pos, move);
+        // Our distance to zeroing: one more than the reply's, or 1 for a zeroing move or a mate
+        ProbeState state;
+        int dtz = zeroing ? -dtzBeforeZeroing(probeWdl(pos, state)) : -probeDtz(pos, state);
+        if (!zeroing && !(dtz == 1 && isCheckmate(pos))) dtz += (dtz > 0) - (dtz < 0);
+        undoMove(pos);
+        if (state == PROBE_FAIL) return false;
+
+        bool win = dtz > 0 && dtz + pos.halfmoveClock <= 100, loss = dtz < 0 && -dtz + pos.halfmoveClock <= 100;
+        int rank = win ? 1000 - dtz : loss ? -1000 - dtz : dtz > 0 ? 1 : dtz < 0 ? -1 : 0;
+        int score = win ? TB_WIN_SCORE - dtz : loss ? -TB_WIN_SCORE - dtz : 0;
+        if (rank > bestRank) {
+            bestRank = rank;
+            result = {move, pos.isWhiteTurn ? score : -score};
+        }
+    }
+    return moves.size() > 0;
+}
+
+#ifdef CHESS_SEARCH_STATS
+string searchStatsPath; // Reports are appended here as JSON lines, or go to stderr if empty
+mutex searchStatsMutex;
+
+// One JSON object per finished search: totals over all threads, the main thread's nodes and effective
+// branching factor for each completed iteration, and nodes by distance from the root
+void writeSearchStats(const Position& pos, const SearchContext& context, const SearchStats& stats, uint64_t cutoffs,
+                      uint64_t firstMoveCutoffs, int depth) {
+    double seconds = max(secondsSince(context.startTime), 1e-9);
+    ostringstream json;
+    json << "{\"fen\":\"" << positionToFen(pos) << "\",\"depth\":" << depth << ",\"threads\":" << context.threads
+         << ",\"time_ms\":" << (int64_t)(seconds * 1000) << ",\"nodes\":" << context.lastSearchNodes
+         << ",\"qnodes\":" << context.lastSearchQNodes << ",\"nps\":" << (uint64_t)(context.lastSearchNodes / seconds)
+         << ",\"cutoffs\":" << cutoffs << ",\"first_move_cutoff_rate\":"
+         << (cutoffs ? (double)firstMoveCutoffs / cutoffs : 0.0) << ",\"tt\":{\"probes\":" << stats.ttProbes
+         << ",\"hits\":" << stats.ttHits << ",\"cutoffs\":" << stats.ttCutoffs << "},\"pruning\":{\"tablebase\":"
+         << context.lastSearchTbHits << ",\"stand_pat\":" << stats.standPatCutoffs << ",\"delta\":" << stats.deltaPruned
+         << "},\"aspiration\":{\"fail_low\":" << stats.aspirationFailLows << ",\"fail_high\":" << stats.aspirationFailHighs
+         << "},\"null_move\":{\"tries\":" << stats.nullMoveTries << ",\"cutoffs\":" << stats.nullMoveCutoffs
+         << "},\"lmr\":{\"reductions\":" << stats.lmrReductions << ",\"researches\":" << stats.lmrResearches
+         << "},\"pvs_researches\":" << stats.pvsResearches << ",\"iterations\":[";
+    for (size_t i = 0; i < stats.iterationNodes.size(); ++i) {
+        json << (i ? "," : "") << "{\"depth\":" << i + 1 << ",\"nodes\":" << stats.iterationNodes[i];
+        if (i > 0 && stats.iterationNodes[i - 1]) {
+            json << ",\"ebf\":" << (double)stats.iterationNodes[i] / stats.iterationNodes[i - 1];
+        }
+        json << "}";
+    }
+    json << "],\"nodes_per_ply\":[";
+    int plies = STATS_MAX_PLY;
+    while (plies > 0 && stats.nodesPerPly[plies - 1] == 0) plies--;
+    for (int ply = 0; ply < plies; ++ply) json << (ply ? "," : "") << stats.nodesPerPly[ply];
+    json << "]}";
+
+    lock_guard<mutex> lock(searchStatsMutex);
+    if (searchStatsPath.empty()) cerr << json.str() << endl;
+    else ofstream(searchStatsPath, ios::app) << json.str() << "\n";
+}
+#endif
+
+// Function to find the best move for the computer. Returns the deepest completed iteration, or
+// the first legal move if the budget ran out before depth 1 finished
+SearchResult findBestMove(Position& pos, SearchContext& context, const SearchLimits& limits = {}, bool verbose = true) {
+    context.transpositionTable.newSearch();
+    context.stopped = false;
+    context.limits = limits;
+    context.startTime = context.lastInfoTime = chrono::steady_clock::now();
+    context.timeBudgetStartMs = 0;
+
+    SearchResult tablebaseMove;
+    if (tablebaseRootMove(pos, tablebaseMove)) {
+        context.lastSearchNodes = context.lastSearchQNodes = 0;
+        context.lastSearchTbHits = 1;
+        context.lastSearchDepth = 1;
+        if (context.uciOutput) {
+            sendLine("info depth 1 score " + uciScore(tablebaseMove.evaluation, pos.isWhiteTurn) + " nodes 0 tbhits 1 pv " +
+                     moveToString(tablebaseMove.move));
+        } else if (verbose) {
+            cout << "Tablebase move: " << moveToString(tablebaseMove.move) << " with evaluation " << tablebaseMove.evaluation
+                 << endl;
+        }
+        return tablebaseMove;
+    }
+
+    // Helpers start at depth 1 or 2 so they are not all in lockstep
+    if ((int)context.pawnTables.size() != context.threads) context.pawnTables.resize(context.threads);
+    for (PawnHashTable& pawnTable : context.pawnTables) pawnTable.probes = pawnTable.hits = 0;
+
+    vector<HelperResult> helperResults(max(context.threads - 1, 0));
+    vector<thread> helpers;
+    for (int i = 1; i < context.threads; ++i) {
+        helpers.emplace_back(helperSearch, pos, ref(context), ref(context.pawnTables[i]), 1 + i % 2, ref(helperResults[i - 1]));
+    }
+
+    SearchWorker worker{pos, context, context.pawnTables[0], true};
+    MoveList rootMoves;
+    generateMoves(pos, rootMoves);
+    SearchResult bestMove = {rootMoves.size() ? rootMoves[0] : NULL_MOVE, 0};
+    int bestDepth = 0;
+    iterativeDeepening(worker, 1, min(max(limits.depth, 1), MAX_DEPTH), bestMove, bestDepth, verbose);
+    context.stopped = true;
+    for (thread& helper : helpers) helper.join();
+
+    // Prefer a helper's result if it completed a deeper search than the main thread
+    context.lastSearchNodes = worker.nodes;
+    context.lastSearchQNodes = worker.qnodes;
+    context.lastSearchTbHits = worker.tbHits;
+    for (const HelperResult& helper : helperResults) {
+        context.lastSearchNodes += helper.nodes;
+        context.lastSearchQNodes += helper.qnodes;
+        context.lastSearchTbHits += helper.tbHits;
+        if (helper.depth > bestDepth && helper.result.move != NULL_MOVE) {
+            bestDepth = helper.depth;
+            bestMove = helper.result;
+        }
+    }
+
+    context.lastSearchDepth = bestDepth;
+    LOG(LOG_INFO, LOG_SEARCH, "best move " << moveToString(bestMove.move) << " score " << bestMove.evaluation << " depth "
+                                           << bestDepth << " nodes " << context.lastSearchNodes << " threads "
+                                           << context.threads);
+
+#ifdef CHESS_SEARCH_STATS
+    uint64_t cutoffs = worker.cutoffs, firstMoveCutoffs = worker.firstMoveCutoffs;
+    SearchStats stats = worker.stats;
+    for (const HelperResult& helper : helperResults) {
+        cutoffs += helper.cutoffs;
+        firstMoveCutoffs += helper.firstMoveCutoffs;
+        stats.add(helper.stats);
+    }
+    writeSearchStats(pos, context, stats, cutoffs, firstMoveCutoffs, bestDepth);
+#endif
+
+    if (verbose) {
+        uint64_t pawnProbes = 0, pawnHits = 0;
+        for (const PawnHashTable& pawnTable : context.pawnTables) {
+            pawnProbes += pawnTable.probes;
+            pawnHits += pawnTable.hits;
+        }
+        cout << "Best move selected: " << moveToString(bestMove.move) << " with evaluation " << bestMove.evaluation
+             << " (depth " << bestDepth << ", hashfull " << context.transpositionTable.hashfull() << ", pawn hash hits "
+             << (pawnProbes ? pawnHits * 100 / pawnProbes : 0) << "% of " << pawnProbes << ")" << endl;
+    }
+    return bestMove;
+}
+
+// Time-to-depth and NPS for 1, 2, 4, 8 and 16 threads, each starting from an empty table
+void runSmpBenchmark(Position& pos, SearchContext& context, const SearchLimits& limits) {
+    double baseline = 0;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        context.transpositionTable.clear();
+        context.threads = threads;
+        auto start = chrono::steady_clock::now();
+        SearchResult result = findBestMove(pos, context, limits, false);
+        double seconds = secondsSince(start);
+        if (threads == 1) baseline = seconds;
+
+        cout << "threads " << threads << "  time " << (int64_t)(seconds * 1000) << " ms  nodes " << context.lastSearchNodes
+             << "  nps " << (uint64_t)(context.lastSearchNodes / seconds) << "  speedup " << baseline / seconds
+             << "  move " << moveToString(result.move) << "\n";
+    }
+}
+
+// Polyglot opening books. A book is keyed by Polyglot's own Zobrist scheme: the 781 fixed "Random64"
+// constants published with the format, for piece-squares (64 per piece, black pawn first, colors
+// interleaved), the four castling rights, the en passant file and White to move
+constexpr uint64_t POLYGLOT_RANDOM[781] = {
+    0x9D39247E33776D41ULL, 0x2AF7398005AAA5C7ULL, 0x44DB015024623547ULL, 0x9C15F73E62A76AE2ULL,
+    0x75834465489C0C89ULL, 0x3290AC3A203001BFULL, 0x0FBBAD1F61042279ULL, 0xE83A908FF2FB60CAULL,
+    0x0D7E765D58755C10ULL, 0x1A083822CEAFE02DULL, 0x9605D5F0E25EC3B0ULL, 0xD021FF5CD13A2ED5ULL,
+    0x40BDF15D4A672E32ULL, 0x011355146FD56395ULL, 0x5DB4832046F3D9E5ULL, 0x239F8B2D7FF719CCULL,
+    0x05D1A1AE85B49AA1ULL, 0x679F848F6E8FC971ULL, 0x7449BBFF801FED0BULL, 0x7D11CDB1C3B7ADF0ULL,
+    0x82C7709E781EB7CCULL, 0xF3218F1C9510786CULL, 0x331478F3AF51BBE6ULL, 0x4BB38DE5E7219443ULL,
+    0xAA649C6EBCFD50FCULL, 0x8DBD98A352AFD40BULL, 0x87D2074B81D79217ULL, 0x19F3C751D3E92AE1ULL,
+    0xB4AB30F062B19ABFULL, 0x7B0500AC42047AC4ULL, 0xC9452CA81A09D85DULL, 0x24AA6C514DA27500ULL,
+    0x4C9F34427501B447ULL, 0x14A68FD73C910841ULL, 0xA71B9B83461CBD93ULL, 0x03488B95B0F1850FULL,
+    0x637B2B34FF93C040ULL, 0x09D1BC9A3DD90A94ULL, 0x3575668334A1DD3BULL, 0x735E2B97A4C45A23ULL,
+    0x18727070F1BD400BULL, 0x1FCBACD259BF02E7ULL, 0xD310A7C2CE9B6555ULL, 0xBF983FE0FE5D8244ULL,
+    0x9F74D14F7454A824ULL, 0x51EBDC4AB9BA3035ULL, 0x5C82C505DB9AB0FAULL, 0xFCF7FE8A3430B241ULL,
+    0x3253A729B9BA3DDEULL, 0x8C74C368081B3075ULL, 0xB9BC6C87167C33E7ULL, 0x7EF48F2B83024E20ULL,
+    0x11D505D4C351BD7FULL, 0x6568FCA92C76A243ULL, 0x4DE0B0F40F32A7B8ULL, 0x96D693460CC37E5DULL,
+    0x42E240CB63689F2FULL, 0x6D2BDCDAE2919661ULL, 0x42880B0236E4D951ULL, 0x5F0F4A5898171BB6ULL,
+    0x39F890F579F92F88ULL, 0x93C5B5F47356388BULL, 0x63DC359D8D231B78ULL, 0xEC16CA8AEA98AD76ULL,
+    0x5355F900C2A82DC7ULL, 0x07FB9F855A997142ULL, 0x5093417AA8A7ED5EULL, 0x7BCBC38DA25A7F3CULL,
+    0x19FC8A768CF4B6D4ULL, 0x637A7780DECFC0D9ULL, 0x8249A47AEE0E41F7ULL, 0x79AD695501E7D1E8ULL,
+    0x14ACBAF4777D5776ULL, 0xF145B6BECCDEA195ULL, 0xDABF2AC8201752FCULL, 0x24C3C94DF9C8D3F6ULL,
+    0xBB6E2924F03912EAULL, 0x0CE26C0B95C980D9ULL, 0xA49CD132BFBF7CC4ULL, 0xE99D662AF4243939ULL,
+    0x27E6AD7891165C3FULL, 0x8535F040B9744FF1ULL, 0x54B3F4FA5F40D873ULL, 0x72B12C32127FED2BULL,
+    0xEE954D3C7B411F47ULL, 0x9A85AC909A24EAA1ULL, 0x70AC4CD9F04F21F5ULL, 0xF9B89D3E99A075C2ULL,
+    0x87B3E2B2B5C907B1ULL, 0xA366E5B8C54F48B8ULL, 0xAE4A9346CC3F7CF2ULL, 0x1920C04D47267BBDULL,
+    0x87BF02C6B49E2AE9ULL, 0x092237AC237F3859ULL, 0xFF07F64EF8ED14D0ULL, 0x8DE8DCA9F03CC54EULL,
+    0x9C1633264DB49C89ULL, 0xB3F22C3D0B0B38EDULL, 0x390E5FB44D01144BULL, 0x5BFEA5B4712768E9ULL,
+    0x1E1032911FA78984ULL, 0x9A74ACB964E78CB3ULL, 0x4F80F7A035DAFB04ULL, 0x6304D09A0B3738C4ULL,
+    0x2171E64683023A08ULL, 0x5B9B63EB9CEFF80CULL, 0x506AACF489889342ULL, 0x1881AFC9A3A701D6ULL,
+    0x6503080440750644ULL, 0xDFD395339CDBF4A7ULL, 0xEF927DBCF00C20F2ULL, 0x7B32F7D1E03680ECULL,
+    0xB9FD7620E7316243ULL, 0x05A7E8A57DB91B77ULL, 0xB5889C6E15630A75ULL, 0x4A750A09CE9573F7ULL,
+    0xCF464CEC899A2F8AULL, 0xF538639CE705B824ULL, 0x3C79A0FF5580EF7FULL, 0xEDE6C87F8477609DULL,
+    0x799E81F05BC93F31ULL, 0x86536B8CF3428A8CULL, 0x97D7374C60087B73ULL, 0xA246637CFF328532ULL,
+    0x043FCAE60CC0EBA0ULL, 0x920E449535DD359EULL, 0x70EB093B15B290CCULL, 0x73A1921916591CBDULL,
+    0x56436C9FE1A1AA8DULL, 0xEFAC4B70633B8F81ULL, 0xBB215798D45DF7AFULL, 0x45F20042F24F1768ULL,
+    0x930F80F4E8EB7462ULL, 0xFF6712FFCFD75EA1ULL, 0xAE623FD67468AA70ULL, 0xDD2C5BC84BC8D8FCULL,
+    0x7EED120D54CF2DD9ULL, 0x22FE545401165F1CULL, 0xC91800E98FB99929ULL, 0x808BD68E6AC10365ULL,
+    0xDEC468145B7605F6ULL, 0x1BEDE3A3AEF53302ULL, 0x43539603D6C55602ULL, 0xAA969B5C691CCB7AULL,
+    0xA87832D392EFEE56ULL, 0x65942C7B3C7E11AEULL, 0xDED2D633CAD004F6ULL, 0x21F08570F420E565ULL,
+    0xB415938D7DA94E3CULL, 0x91B859E59ECB6350ULL, 0x10CFF333E0ED804AULL, 0x28AED140BE0BB7DDULL,
+    0xC5CC1D89724FA456ULL, 0x5648F680F11A2741ULL, 0x2D255069F0B7DAB3ULL, 0x9BC5A38EF729ABD4ULL,
+    0xEF2F054308F6A2BCULL, 0xAF2042F5CC5C2858ULL, 0x480412BAB7F5BE2AULL, 0xAEF3AF4A563DFE43ULL,
+    0x19AFE59AE451497FULL, 0x52593803DFF1E840ULL, 0xF4F076E65F2CE6F0ULL, 0x11379625747D5AF3ULL,
+    0xBCE5D2248682C115ULL, 0x9DA4243DE836994FULL, 0x066F70B33FE09017ULL, 0x4DC4DE189B671A1CULL,
+    0x51039AB7712457C3ULL, 0xC07A3F80C31FB4B4ULL, 0xB46EE9C5E64A6E7CULL, 0xB3819A42ABE61C87ULL,
+    0x21A007933A522A20ULL, 0x2DF16F761598AA4FULL, 0x763C4A1371B368FDULL, 0xF793C46702E086A0ULL,
+    0xD7288E012AEB8D31ULL, 0xDE336A2A4BC1C44BULL, 0x0BF692B38D079F23ULL, 0x2C604A7A177326B3ULL,
+    0x4850E73E03EB6064ULL, 0xCFC447F1E53C8E1BULL, 0xB05CA3F564268D99ULL, 0x9AE182C8BC9474E8ULL,
+    0xA4FC4BD4FC5558CAULL, 0xE755178D58FC4E76ULL, 0x69B97DB1A4C03DFEULL, 0xF9B5B7C4ACC67C96ULL,
+    0xFC6A82D64B8655FBULL, 0x9C684CB6C4D24417ULL, 0x8EC97D2917456ED0ULL, 0x6703DF9D2924E97EULL,
+    0xC547F57E42A7444EULL, 0x78E37644E7CAD29EULL, 0xFE9A44E9362F05FAULL, 0x08BD35CC38336615ULL,
+    0x9315E5EB3A129ACEULL, 0x94061B871E04DF75ULL, 0xDF1D9F9D784BA010ULL, 0x3BBA57B68871B59DULL,
+    0xD2B7ADEEDED1F73FULL, 0xF7A255D83BC373F8ULL, 0xD7F4F2448C0CEB81ULL, 0xD95BE88CD210FFA7ULL,
+    0x336F52F8FF4728E7ULL, 0xA74049DAC312AC71ULL, 0xA2F61BB6E437FDB5ULL, 0x4F2A5CB07F6A35B3ULL,
+    0x87D380BDA5BF7859ULL, 0x16B9F7E06C453A21ULL, 0x7BA2484C8A0FD54EULL, 0xF3A678CAD9A2E38CULL,
+    0x39B0BF7DDE437BA2ULL, 0xFCAF55C1BF8A4424ULL, 0x18FCF680573FA594ULL, 0x4C0563B89F495AC3ULL,
+    0x40E087931A00930DULL, 0x8CFFA9412EB642C1ULL, 0x68CA39053261169FULL, 0x7A1EE967D27579E2ULL,
+    0x9D1D60E5076F5B6FULL, 0x3810E399B6F65BA2ULL, 0x32095B6D4AB5F9B1ULL, 0x35CAB62109DD038AULL,
+    0xA90B24499FCFAFB1ULL, 0x77A225A07CC2C6BDULL, 0x513E5E634C70E331ULL, 0x4361C0CA3F692F12ULL,
+    0xD941ACA44B20A45BULL, 0x528F7C8602C5807BULL, 0x52AB92BEB9613989ULL, 0x9D1DFA2EFC557F73ULL,
+    0x722FF175F572C348ULL, 0x1D1260A51107FE97ULL, 0x7A249A57EC0C9BA2ULL, 0x04208FE9E8F7F2D6ULL,
+    0x5A110C6058B920A0ULL, 0x0CD9A497658A5698ULL, 0x56FD23C8F9715A4CULL, 0x284C847B9D887AAEULL,
+    0x04FEABFBBDB619CBULL, 0x742E1E651C60BA83ULL, 0x9A9632E65904AD3CULL, 0x881B82A13B51B9E2ULL,
+    0x506E6744CD974924ULL, 0xB0183DB56FFC6A79ULL, 0x0ED9B915C66ED37EULL, 0x5E11E86D5873D484ULL,
+    0xF678647E3519AC6EULL, 0x1B85D488D0F20CC5ULL, 0xDAB9FE6525D89021ULL, 0x0D151D86ADB73615ULL,
+    0xA865A54EDCC0F019ULL, 0x93C42566AEF98FFBULL, 0x99E7AFEABE000731ULL, 0x48CBFF086DDF285AULL,
+    0x7F9B6AF1EBF78BAFULL, 0x58627E1A149BBA21ULL, 0x2CD16E2ABD791E33ULL, 0xD363EFF5F0977996ULL,
+    0x0CE2A38C344A6EEDULL, 0x1A804AADB9CFA741ULL, 0x907F30421D78C5DEULL, 0x501F65EDB3034D07ULL,
+    0x37624AE5A48FA6E9ULL, 0x957BAF61700CFF4EULL, 0x3A6C27934E31188AULL, 0xD49503536ABCA345ULL,
+    0x088E049589C432E0ULL, 0xF943AEE7FEBF21B8ULL, 0x6C3B8E3E336139D3ULL, 0x364F6FFA464EE52EULL,
+    0xD60F6DCEDC314222ULL, 0x56963B0DCA418FC0ULL, 0x16F50EDF91E513AFULL, 0xEF1955914B609F93ULL,
+    0x565601C0364E3228ULL, 0xECB53939887E8175ULL, 0xBAC7A9A18531294BULL, 0xB344C470397BBA52ULL,
+    0x65D34954DAF3CEBDULL, 0xB4B81B3FA97511E2ULL, 0xB422061193D6F6A7ULL, 0x071582401C38434DULL,
+    0x7A13F18BBEDC4FF5ULL, 0xBC4097B116C524D2ULL, 0x59B97885E2F2EA28ULL, 0x99170A5DC3115544ULL,
+    0x6F423357E7C6A9F9ULL, 0x325928EE6E6F8794ULL, 0xD0E4366228B03343ULL, 0x565C31F7DE89EA27ULL,
+    0x30F5611484119414ULL, 0xD873DB391292ED4FULL, 0x7BD94E1D8E17DEBCULL, 0xC7D9F16864A76E94ULL,
+    0x947AE053EE56E63CULL, 0xC8C93882F9475F5FULL, 0x3A9BF55BA91F81CAULL, 0xD9A11FBB3D9808E4ULL,
+    0x0FD22063EDC29FCAULL, 0xB3F256D8ACA0B0B9ULL, 0xB03031A8B4516E84ULL, 0x35DD37D5871448AFULL,
+    0xE9F6082B05542E4EULL, 0xEBFAFA33D7254B59ULL, 0x9255ABB50D532280ULL, 0xB9AB4CE57F2D34F3ULL,
+    0x693501D628297551ULL, 0xC62C58F97DD949BFULL, 0xCD454F8F19C5126AULL, 0xBBE83F4ECC2BDECBULL,
+    0xDC842B7E2819E230ULL, 0xBA89142E007503B8ULL, 0xA3BC941D0A5061CBULL, 0xE9F6760E32CD8021ULL,
+    0x09C7E552BC76492FULL, 0x852F54934DA55CC9ULL, 0x8107FCCF064FCF56ULL, 0x098954D51FFF6580ULL,
+    0x23B70EDB1955C4BFULL, 0xC330DE426430F69DULL, 0x4715ED43E8A45C0AULL, 0xA8D7E4DAB780A08DULL,
+    0x0572B974F03CE0BBULL, 0xB57D2E985E1419C7ULL, 0xE8D9ECBE2CF3D73FULL, 0x2FE4B17170E59750ULL,
+    0x11317BA87905E790ULL, 0x7FBF21EC8A1F45ECULL, 0x1725CABFCB045B00ULL, 0x964E915CD5E2B207ULL,
+    0x3E2B8BCBF016D66DULL, 0xBE7444E39328A0ACULL, 0xF85B2B4FBCDE44B7ULL, 0x49353FEA39BA63B1ULL,
+    0x1DD01AAFCD53486AULL, 0x1FCA8A92FD719F85ULL, 0xFC7C95D827357AFAULL, 0x18A6A990C8B35EBDULL,
+    0xCCCB7005C6B9C28DULL, 0x3BDBB92C43B17F26ULL, 0xAA70B5B4F89695A2ULL, 0xE94C39A54A98307FULL,
+    0xB7A0B174CFF6F36EULL, 0xD4DBA84729AF48ADULL, 0x2E18BC1AD9704A68ULL, 0x2DE0966DAF2F8B1CULL,
+    0xB9C11D5B1E43A07EULL, 0x64972D68DEE33360ULL, 0x94628D38D0C20584ULL, 0xDBC0D2B6AB90A559ULL,
+    0xD2733C4335C6A72FULL, 0x7E75D99D94A70F4DULL, 0x6CED1983376FA72BULL, 0x97FCAACBF030BC24ULL,
+    0x7B77497B32503B12ULL, 0x8547EDDFB81CCB94ULL, 0x79999CDFF70902CBULL, 0xCFFE1939438E9B24ULL,
+    0x829626E3892D95D7ULL, 0x92FAE24291F2B3F1ULL, 0x63E22C147B9C3403ULL, 0xC678B6D860284A1CULL,
+    0x5873888850659AE7ULL, 0x0981DCD296A8736DULL, 0x9F65789A6509A440ULL, 0x9FF38FED72E9052FULL,
+    0xE479EE5B9930578CULL, 0xE7F28ECD2D49EECDULL, 0x56C074A581EA17FEULL, 0x5544F7D774B14AEFULL,
+    0x7B3F0195FC6F290FULL, 0x12153635B2C0CF57ULL, 0x7F5126DBBA5E0CA7ULL, 0x7A76956C3EAFB413ULL,
+    0x3D5774A11D31AB39ULL, 0x8A1B083821F40CB4ULL, 0x7B4A38E32537DF62ULL, 0x950113646D1D6E03ULL,
+    0x4DA8979A0041E8A9ULL, 0x3BC36E078F7515D7ULL, 0x5D0A12F27AD310D1ULL, 0x7F9D1A2E1EBE1327ULL,
+    0xDA3A361B1C5157B1ULL, 0xDCDD7D20903D0C25ULL, 0x36833336D068F707ULL, 0xCE68341F79893389ULL,
+    0xAB9090168DD05F34ULL, 0x43954B3252DC25E5ULL, 0xB438C2B67F98E5E9ULL, 0x10DCD78E3851A492ULL,
+    0xDBC27AB5447822BFULL, 0x9B3CDB65F82CA382ULL, 0xB67B7896167B4C84ULL, 0xBFCED1B0048EAC50ULL,
+    0xA9119B60369FFEBDULL, 0x1FFF7AC80904BF45ULL, 0xAC12FB171817EEE7ULL, 0xAF08DA9177DDA93DULL,
+    0x1B0CAB936E65C744ULL, 0xB559EB1D04E5E932ULL, 0xC37B45B3F8D6F2BAULL, 0xC3A9DC228CAAC9E9ULL,
+    0xF3B8B6675A6507FFULL, 0x9FC477DE4ED681DAULL, 0x67378D8ECCEF96CBULL, 0x6DD856D94D259236ULL,
+    0xA319CE15B0B4DB31ULL, 0x073973751F12DD5EULL, 0x8A8E849EB32781A5ULL, 0xE1925C71285279F5ULL,
+    0x74C04BF1790C0EFEULL, 0x4DDA48153C94938AULL, 0x9D266D6A1CC0542CULL, 0x7440FB816508C4FEULL,
+    0x13328503DF48229FULL, 0xD6BF7BAEE43CAC40ULL, 0x4838D65F6EF6748FULL, 0x1E152328F3318DEAULL,
+    0x8F8419A348F296BFULL, 0x72C8834A5957B511ULL, 0xD7A023A73260B45CULL, 0x94EBC8ABCFB56DAEULL,
+    0x9FC10D0F989993E0ULL, 0xDE68A2355B93CAE6ULL, 0xA44CFE79AE538BBEULL, 0x9D1D84FCCE371425ULL,
+    0x51D2B1AB2DDFB636ULL, 0x2FD7E4B9E72CD38CULL, 0x65CA5B96B7552210ULL, 0xDD69A0D8AB3B546DULL,
+    0x604D51B25FBF70E2ULL, 0x73AA8A564FB7AC9EULL, 0x1A8C1E992B941148ULL, 0xAAC40A2703D9BEA0ULL,
+    0x764DBEAE7FA4F3A6ULL, 0x1E99B96E70A9BE8BULL, 0x2C5E9DEB57EF4743ULL, 0x3A938FEE32D29981ULL,
+    0x26E6DB8FFDF5ADFEULL, 0x469356C504EC9F9DULL, 0xC8763C5B08D1908CULL, 0x3F6C6AF859D80055ULL,
+    0x7F7CC39420A3A545ULL, 0x9BFB227EBDF4C5CEULL, 0x89039D79D6FC5C5CULL, 0x8FE88B57305E2AB6ULL,
+    0xA09E8C8C35AB96DEULL, 0xFA7E393983325753ULL, 0xD6B6D0ECC617C699ULL, 0xDFEA21EA9E7557E3ULL,
+    0xB67C1FA481680AF8ULL, 0xCA1E3785A9E724E5ULL, 0x1CFC8BED0D681639ULL, 0xD18D8549D140CAEAULL,
+    0x4ED0FE7E9DC91335ULL, 0xE4DBF0634473F5D2ULL, 0x1761F93A44D5AEFEULL, 0x53898E4C3910DA55ULL,
+    0x734DE8181F6EC39AULL, 0x2680B122BAA28D97ULL, 0x298AF231C85BAFABULL, 0x7983EED3740847D5ULL,
+    0x66C1A2A1A60CD889ULL, 0x9E17E49642A3E4C1ULL, 0xEDB454E7BADC0805ULL, 0x50B704CAB602C329ULL,
+    0x4CC317FB9CDDD023ULL, 0x66B4835D9EAFEA22ULL, 0x219B97E26FFC81BDULL, 0x261E4E4C0A333A9DULL,
+    0x1FE2CCA76517DB90ULL, 0xD7504DFA8816EDBBULL, 0xB9571FA04DC089C8ULL, 0x1DDC0325259B27DEULL,
+    0xCF3F4688801EB9AAULL, 0xF4F5D05C10CAB243ULL, 0x38B6525C21A42B0EULL, 0x36F60E2BA4FA6800ULL,
+    0xEB3593803173E0CEULL, 0x9C4CD6257C5A3603ULL, 0xAF0C317D32ADAA8AULL, 0x258E5A80C7204C4BULL,
+    0x8B889D624D44885DULL, 0xF4D14597E660F855ULL, 0xD4347F66EC8941C3ULL, 0xE699ED85B0DFB40DULL,
+    0x2472F6207C2D0484ULL, 0xC2A1E7B5B459AEB5ULL, 0xAB4F6451CC1D45ECULL, 0x63767572AE3D6174ULL,
+    0xA59E0BD101731A28ULL, 0x116D0016CB948F09ULL, 0x2CF9C8CA052F6E9FULL, 0x0B090A7560A968E3ULL,
+    0xABEEDDB2DDE06FF1ULL, 0x58EFC10B06A2068DULL, 0xC6E57A78FBD986E0ULL, 0x2EAB8CA63CE802D7ULL,
+    0x14A195640116F336ULL, 0x7C0828DD624EC390ULL, 0xD74BBE77E6116AC7ULL, 0x804456AF10F5FB53ULL,
+    0xEBE9EA2ADF4321C7ULL, 0x03219A39EE587A30ULL, 0x49787FEF17AF9924ULL, 0xA1E9300CD8520548ULL,
+    0x5B45E522E4B1B4EFULL, 0xB49C3B3995091A36ULL, 0xD4490AD526F14431ULL, 0x12A8F216AF9418C2ULL,
+    0x001F837CC7350524ULL, 0x1877B51E57A764D5ULL, 0xA2853B80F17F58EEULL, 0x993E1DE72D36D310ULL,
+    0xB3598080CE64A656ULL, 0x252F59CF0D9F04BBULL, 0xD23C8E176D113600ULL, 0x1BDA0492E7E4586EULL,
+    0x21E0BD5026C619BFULL, 0x3B097ADAF088F94EULL, 0x8D14DEDB30BE846EULL, 0xF95CFFA23AF5F6F4ULL,
+    0x3871700761B3F743ULL, 0xCA672B91E9E4FA16ULL, 0x64C8E531BFF53B55ULL, 0x241260ED4AD1E87DULL,
+    0x106C09B972D2E822ULL, 0x7FBA195410E5CA30ULL, 0x7884D9BC6CB569D8ULL, 0x0647DFEDCD894A29ULL,
+    0x63573FF03E224774ULL, 0x4FC8E9560F91B123ULL, 0x1DB956E450275779ULL, 0xB8D91274B9E9D4FBULL,
+    0xA2EBEE47E2FBFCE1ULL, 0xD9F1F30CCD97FB09ULL, 0xEFED53D75FD64E6BULL, 0x2E6D02C36017F67FULL,
+    0xA9AA4D20DB084E9BULL, 0xB64BE8D8B25396C1ULL, 0x70CB6AF7C2D5BCF0ULL, 0x98F076A4F7A2322EULL,
+    0xBF84470805E69B5FULL, 0x94C3251F06F90CF3ULL, 0x3E003E616A6591E9ULL, 0xB925A6CD0421AFF3ULL,
+    0x61BDD1307C66E300ULL, 0xBF8D5108E27E0D48ULL, 0x240AB57A8B888B20ULL, 0xFC87614BAF287E07ULL,
+    0xEF02CDD06FFDB432ULL, 0xA1082C0466DF6C0AULL, 0x8215E577001332C8ULL, 0xD39BB9C3A48DB6CFULL,
+    0x2738259634305C14ULL, 0x61CF4F94C97DF93DULL, 0x1B6BACA2AE4E125BULL, 0x758F450C88572E0BULL,
+    0x959F587D507A8359ULL, 0xB063E962E045F54DULL, 0x60E8ED72C0DFF5D1ULL, 0x7B64978555326F9FULL,
+    0xFD080D236DA814BAULL, 0x8C90FD9B083F4558ULL, 0x106F72FE81E2C590ULL, 0x7976033A39F7D952ULL,
+    0xA4EC0132764CA04BULL, 0x733EA705FAE4FA77ULL, 0xB4D8F77BC3E56167ULL, 0x9E21F4F903B33FD9ULL,
+    0x9D765E419FB69F6DULL, 0xD30C088BA61EA5EFULL, 0x5D94337FBFAF7F5BULL, 0x1A4E4822EB4D7A59ULL,
+    0x6FFE73E81B637FB3ULL, 0xDDF957BC36D8B9CAULL, 0x64D0E29EEA8838B3ULL, 0x08DD9BDFD96B9F63ULL,
+    0x087E79E5A57D1D13ULL, 0xE328E230E3E2B3FBULL, 0x1C2559E30F0946BEULL, 0x720BF5F26F4D2EAAULL,
+    0xB0774D261CC609DBULL, 0x443F64EC5A371195ULL, 0x4112CF68649A260EULL, 0xD813F2FAB7F5C5CAULL,
+    0x660D3257380841EEULL, 0x59AC2C7873F910A3ULL, 0xE846963877671A17ULL, 0x93B633ABFA3469F8ULL,
+    0xC0C0F5A60EF4CDCFULL, 0xCAF21ECD4377B28CULL, 0x57277707199B8175ULL, 0x506C11B9D90E8B1DULL,
+    0xD83CC2687A19255FULL, 0x4A29C6465A314CD1ULL, 0xED2DF21216235097ULL, 0xB5635C95FF7296E2ULL,
+    0x22AF003AB672E811ULL, 0x52E762596BF68235ULL, 0x9AEBA33AC6ECC6B0ULL, 0x944F6DE09134DFB6ULL,
+    0x6C47BEC883A7DE39ULL, 0x6AD047C430A12104ULL, 0xA5B1CFDBA0AB4067ULL, 0x7C45D833AFF07862ULL,
+    0x5092EF950A16DA0BULL, 0x9338E69C052B8E7BULL, 0x455A4B4CFE30E3F5ULL, 0x6B02E63195AD0CF8ULL,
+    0x6B17B224BAD6BF27ULL, 0xD1E0CCD25BB9C169ULL, 0xDE0C89A556B9AE70ULL, 0x50065E535A213CF6ULL,
+    0x9C1169FA2777B874ULL, 0x78EDEFD694AF1EEDULL, 0x6DC93D9526A50E68ULL, 0xEE97F453F06791EDULL,
+    0x32AB0EDB696703D3ULL, 0x3A6853C7E70757A7ULL, 0x31865CED6120F37DULL, 0x67FEF95D92607890ULL,
+    0x1F2B1D1F15F6DC9CULL, 0xB69E38A8965C6B65ULL, 0xAA9119FF184CCCF4ULL, 0xF43C732873F24C13ULL,
+    0xFB4A3D794A9A80D2ULL, 0x3550C2321FD6109CULL, 0x371F77E76BB8417EULL, 0x6BFA9AAE5EC05779ULL,
+    0xCD04F3FF001A4778ULL, 0xE3273522064480CAULL, 0x9F91508BFFCFC14AULL, 0x049A7F41061A9E60ULL,
+    0xFCB6BE43A9F2FE9BULL, 0x08DE8A1C7797DA9BULL, 0x8F9887E6078735A1ULL, 0xB5B4071DBFC73A66ULL,
+    0x230E343DFBA08D33ULL, 0x43ED7F5A0FAE657DULL, 0x3A88A0FBBCB05C63ULL, 0x21874B8B4D2DBC4FULL,
+    0x1BDEA12E35F6A8C9ULL, 0x53C065C6C8E63528ULL, 0xE34A1D250E7A8D6BULL, 0xD6B04D3B7651DD7EULL,
+    0x5E90277E7CB39E2DULL, 0x2C046F22062DC67DULL, 0xB10BB459132D0A26ULL, 0x3FA9DDFB67E2F199ULL,
+    0x0E09B88E1914F7AFULL, 0x10E8B35AF3EEAB37ULL, 0x9EEDECA8E272B933ULL, 0xD4C718BC4AE8AE5FULL,
+    0x81536D601170FC20ULL, 0x91B534F885818A06ULL, 0xEC8177F83F900978ULL, 0x190E714FADA5156EULL,
+    0xB592BF39B0364963ULL, 0x89C350C893AE7DC1ULL, 0xAC042E70F8B383F2ULL, 0xB49B52E587A1EE60ULL,
+    0xFB152FE3FF26DA89ULL, 0x3E666E6F69AE2C15ULL, 0x3B544EBE544C19F9ULL, 0xE805A1E290CF2456ULL,
+    0x24B33C9D7ED25117ULL, 0xE74733427B72F0C1ULL, 0x0A804D18B7097475ULL, 0x57E3306D881EDB4FULL,
+    0x4AE7D6A36EB5DBCBULL, 0x2D8D5432157064C8ULL, 0xD1E649DE1E7F268BULL, 0x8A328A1CEDFE552CULL,
+    0x07A3AEC79624C7DAULL, 0x84547DDC3E203C94ULL, 0x990A98FD5071D263ULL, 0x1A4FF12616EEFC89ULL,
+    0xF6F7FD1431714200ULL, 0x30C05B1BA332F41CULL, 0x8D2636B81555A786ULL, 0x46C9FEB55D120902ULL,
+    0xCCEC0A73B49C9921ULL, 0x4E9D2827355FC492ULL, 0x19EBB029435DCB0FULL, 0x4659D2B743848A2CULL,
+    0x963EF2C96B33BE31ULL, 0x74F85198B05A2E7DULL, 0x5A0F544DD2B1FB18ULL, 0x03727073C2E134B1ULL,
+    0xC7F6AA2DE59AEA61ULL, 0x352787BAA0D7C22FULL, 0x9853EAB63B5E0B35ULL, 0xABBDCDD7ED5C0860ULL,
+    0xCF05DAF5AC8D77B0ULL, 0x49CAD48CEBF4A71EULL, 0x7A4C10EC2158C4A6ULL, 0xD9E92AA246BF719EULL,
+    0x13AE978D09FE5557ULL, 0x730499AF921549FFULL, 0x4E4B705B92903BA4ULL, 0xFF577222C14F0A3AULL,
+    0x55B6344CF97AAFAEULL, 0xB862225B055B6960ULL, 0xCAC09AFBDDD2CDB4ULL, 0xDAF8E9829FE96B5FULL,
+    0xB5FDFC5D3132C498ULL, 0x310CB380DB6F7503ULL, 0xE87FBB46217A360EULL, 0x2102AE466EBB1148ULL,
+    0xF8549E1A3AA5E00DULL, 0x07A69AFDCC42261AULL, 0xC4C118BFE78FEAAEULL, 0xF9F4892ED96BD438ULL,
+    0x1AF3DBE25D8F45DAULL, 0xF5B4B0B0D2DEEEB4ULL, 0x962ACEEFA82E1C84ULL, 0x046E3ECAAF453CE9ULL,
+    0xF05D129681949A4CULL, 0x964781CE734B3C84ULL, 0x9C2ED44081CE5FBDULL, 0x522E23F3925E319EULL,
+    0x177E00F9FC32F791ULL, 0x2BC60A63A6F3B3F2ULL, 0x222BBFAE61725606ULL, 0x486289DDCC3D6780ULL,
+    0x7DC7785B8EFDFC80ULL, 0x8AF38731C02BA980ULL, 0x1FAB64EA29A2DDF7ULL, 0xE4D9429322CD065AULL,
+    0x9DA058C67844F20CULL, 0x24C0E332B70019B0ULL, 0x233003B5A6CFE6ADULL, 0xD586BD01C5C217F6ULL,
+    0x5E5637885F29BC2BULL, 0x7EBA726D8C94094BULL, 0x0A56A5F0BFE39272ULL, 0xD79476A84EE20D06ULL,
+    0x9E4C1269BAA4BF37ULL, 0x17EFEE45B0DEE640ULL, 0x1D95B0A5FCF90BC6ULL, 0x93CBE0B699C2585DULL,
+    0x65FA4F227A2B6D79ULL, 0xD5F9E858292504D5ULL, 0xC2B5A03F71471A6FULL, 0x59300222B4561E00ULL,
+    0xCE2F8642CA0712DCULL, 0x7CA9723FBB2E8988ULL, 0x2785338347F2BA08ULL, 0xC61BB3A141E50E8CULL,
+    0x150F361DAB9DEC26ULL, 0x9F6A419D382595F4ULL, 0x64A53DC924FE7AC9ULL, 0x142DE49FFF7A7C3DULL,
+    0x0C335248857FA9E7ULL, 0x0A9C32D5EAE45305ULL, 0xE6C42178C4BBB92EULL, 0x71F1CE2490D20B07ULL,
+    0xF1BCC3D275AFE51AULL, 0xE728E8C83C334074ULL, 0x96FBF83A12884624ULL, 0x81A1549FD6573DA5ULL,
+    0x5FA7867CAF35E149ULL, 0x56986E2EF3ED091BULL, 0x917F1DD5F8886C61ULL, 0xD20D8C88C8FFE65FULL,
+    0x31D71DCE64B2C310ULL, 0xF165B587DF898190ULL, 0xA57E6339DD2CF3A0ULL, 0x1EF6E6DBB1961EC9ULL,
+    0x70CC73D90BC26E24ULL, 0xE21A6B35DF0C3AD7ULL, 0x003A93D8B2806962ULL, 0x1C99DED33CB890A1ULL,
+    0xCF3145DE0ADD4289ULL, 0xD0E4427A5514FB72ULL, 0x77C621CC9FB3A483ULL, 0x67A34DAC4356550BULL,
+    0xF8D626AAAF278509ULL
+};
+const uint64_t POLYGLOT_START_KEY = 0x463B96181691FC9CULL;
+
+uint64_t polyglotKey(const Position& pos) {
+    uint64_t key = 0;
+    for (int piece = 0; piece < 12; ++piece) {
+        // Polyglot interleaves colors: black pawn, white pawn, black knight, ...
+        int kind = (piece % 6) * 2 + (piece < BLACK_PAWN ? 1 : 0);
+        for (uint64_t pieces = pos.bitboards[piece]; pieces; pieces &= pieces - 1) {
+            key ^= POLYGLOT_RANDOM[64 * kind + __builtin_ctzll(pieces)];
+        }
+    }
+    for (int right = 0; right < 4; ++right) {
+        if (pos.castlingRights & (1 << right)) key ^= POLYGLOT_RANDOM[768 + right];
+    }
+    // The en passant file only counts when a pawn of the side to move stands next to the pushed pawn
+    uint64_t ownPawns = pos.bitboards[pos.isWhiteTurn ? WHITE_PAWN : BLACK_PAWN];
+    if (pawnAttacks(pos.enPassantTarget, !pos.isWhiteTurn) & ownPawns) {
+        key ^= POLYGLOT_RANDOM[772 + __builtin_ctzll(pos.enPassantTarget) % 8];
+    }
+    if (pos.isWhiteTurn) key ^= POLYGLOT_RANDOM[780];
+    return key;
+}
+
+// A Polyglot .bin book: 16-byte big-endian entries (key, move, weight, learn) sorted by key. The file is
+// memory-mapped, so opening reads nothing and a lookup touches only the pages its binary search visits
+struct PolyglotBook {
+    const uint8_t* data = nullptr;
+    size_t entryCount = 0;
+    int maxPly = 20;           // Leave the book after this many plies of the game
+    bool bestMove = false;     // Always play the highest-weighted move instead of choosing by weight
+    mt19937_64 generator{random_device{}()};
+
+    PolyglotBook() = default;
+    PolyglotBook(const PolyglotBook&) = delete;
+    PolyglotBook& operator=(const PolyglotBook&) = delete;
+    ~PolyglotBook() { close(); }
+
+    bool open(const string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            LOG(LOG_ERROR, LOG_IO, "could not open book " << path);
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size >= 16) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = (const uint8_t*)mapped;
+                entryCount = info.st_size / 16;
+            }
+        }
+        ::close(fd); // The mapping stays valid without the descriptor
+        if (!data) LOG(LOG_ERROR, LOG_IO, "could not map book " << path);
+        return data != nullptr;
+    }
+
+    void close() {
+        if (data) munmap((void*)data, entryCount * 16);
+        data = nullptr;
+        entryCount = 0;
+    }
+
+    static uint64_t readBigEndian(const uint8_t* bytes, int count) {
+        uint64_t value = 0;
+        for (int i = 0; i < count; ++i) value = (value << 8) | bytes[i];
+        return value;
+    }
+
+    uint64_t entryKey(size_t index) const { return readBigEndian(data + index * 16, 8); }
+
+    // Polyglot moves are to-file, to-row, from-file, from-row and promotion piece in 3-bit fields,
+    // with castling written as the king taking its own rook
+    static Move decodeMove(const Position& pos, uint16_t encoded) {
+        int toSquare = encoded & 63;
+        int fromSquare = (encoded >> 6) & 63;
+        int promotion = (encoded >> 12) & 7;
+        int piece = pieceOn(pos, fromSquare);
+        if ((piece == WHITE_KING || piece == BLACK_KING) && fromSquare % 8 == 4 && pieceOn(pos, toSquare) == piece - 2) {
+            if (toSquare % 8 == 7) toSquare = fromSquare + 2;
+            else if (toSquare % 8 == 0) toSquare = fromSquare - 2;
+        }
+        return findMove(pos, fromSquare, toSquare, " nbrq"[promotion]);
+    }
+
+    // A book move for the position, or NULL_MOVE when out of book. Entries whose move is not legal
+    // here (key collisions) and zero-weight entries are skipped
+    Move probe(const Position& pos) {
+        if (!data || pos.gamePly >= maxPly) return NULL_MOVE;
+        uint64_t key = polyglotKey(pos);
+        size_t low = 0, high = entryCount;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (entryKey(middle) < key) low = middle + 1;
+            else high = middle;
+        }
+
+        vector<pair<Move, uint32_t>> candidates;
+        uint32_t totalWeight = 0;
+        for (size_t i = low; i < entryCount && entryKey(i) == key; ++i) {
+            const uint8_t* entry = data + i * 16;
+            uint32_t weight = (uint32_t)readBigEndian(entry + 10, 2);
+            Move move = decodeMove(pos, (uint16_t)readBigEndian(entry + 8, 2));
+            if (move == NULL_MOVE || weight == 0) continue;
+            candidates.push_back({move, weight});
+            totalWeight += weight;
+        }
+        if (candidates.empty()) return NULL_MOVE;
+
+        if (bestMove) {
+            return max_element(candidates.begin(), candidates.end(),
+                               [](const auto& a, const auto& b) { return a.second < b.second; })->first;
+        }
+        uint64_t pick = generator() % totalWeight;
+        for (const auto& [move, weight] : candidates) {
+            if (pick < weight) return move;
+            pick -= weight;
+        }
+        return candidates.back().first;
+    }
+};
+
+PolyglotBook openingBook;
+
+// Keys of the positions listed with the Polyglot format, then the moves of a small fixture book: the
+// best-weighted move of the start position, a reply, and castling written as the king taking its rook
+bool runBookCheck(const string& fixturePath) {
+    const pair<const char*, uint64_t> knownKeys[] = {
+        {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", POLYGLOT_START_KEY},
+        {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", 0x823C9B50FD114196ULL},
+        {"rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", 0x0756B94461C50FB0ULL},
+        {"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", 0x662FAFB965DB29D4ULL},
+        {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 0x22A48B5A8E47FF78ULL},
+        {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3", 0x652A607CA3F242C1ULL},
+        {"rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4", 0x00FDD303C946BDD9ULL},
+        {"rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3", 0x3C8123EA7B067637ULL},
+        {"rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4", 0x5C3F9B829B279560ULL},
+    };
+    bool ok = true;
+    Position pos;
+    for (const auto& [fen, key] : knownKeys) {
+        setPositionFromFEN(pos, fen);
+        if (polyglotKey(pos) != key) {
+            cout << fen << ": key " << hex << polyglotKey(pos) << ", expected " << key << dec << "\n";
+            ok = false;
+        }
+    }
+
+    const pair<const char*, const char*> bookMoves[] = {
+        {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "e2e4"},
+        {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", "c7c5"},
+        {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "e1g1"},
+        {"r3k2r/8/8/8/8/8/8/R3K2R b KQkq - 0 1", "e8c8"},
+    };
+    PolyglotBook book;
+    book.bestMove = true;
+    if (!book.open(fixturePath)) {
+        cout << "Could not open book " << fixturePath << "\n";
+        return false;
+    }
+    for (const auto& [fen, expected] : bookMoves) {
+        setPositionFromFEN(pos, fen);
+        Move move = book.probe(pos);
+        string played = move == NULL_MOVE ? "none" : moveToString(move);
+        if (played != expected) {
+            cout << fen << ": book move " << played << ", expected " << expected << "\n";
+            ok = false;
+        }
+    }
+    cout << (ok ? "Polyglot keys and book moves match\n" : "Polyglot keys or book moves are wrong\n");
+    return ok;
+}
+
+// The reply we expect in a position: its hash move, if that is legal there
+Move predictedMove(const Position& pos, const TranspositionTable& transpositionTable) {
+    TTEntry entry;
+    if (!transpositionTable.probe(pos.hash(), entry)) return NULL_MOVE;
+    MoveList moves;
+    generateMoves(pos, moves);
+    return find(moves.begin(), moves.end(), entry.move()) != moves.end() ? entry.move() : NULL_MOVE;
+}
+
+// The opponent played the move we were pondering on: the search carries on as a normal one, with its
+// depth and transposition table intact and its time budget starting now
+void ponderHit(SearchContext& context) {
+    context.timeBudgetStartMs.store(
+        chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - context.startTime).count(),
+        memory_order_relaxed);
+    context.pondering.store(false, memory_order_release);
+}
+
+// Pondering in the game against the computer: after the engine moves, search the position after the
+// reply it expects while the opponent thinks
+struct PonderSearch {
+    SearchContext& context;
+    SearchLimits limits;
+    Position position;
+    Move move = NULL_MOVE; // Expected reply, or NULL_MOVE when not pondering
+    SearchResult result = {NULL_MOVE, 0};
+    thread worker;
+
+    PonderSearch(SearchContext& context, const SearchLimits& limits) : context(context), limits(limits) {}
+    ~PonderSearch() { stop(); }
+
+    // Start on the reply stored in the transposition table for this position, if there is one
+    void start(const Position& game) {
+        move = predictedMove(game, context.transpositionTable);
+        if (move == NULL_MOVE) return;
+        position = game;
+        makeMove(position, move);
+        context.stopRequested = false;
+        context.pondering = true;
+        worker = thread([this]() { result = findBestMove(position, context, limits, false); });
+    }
+
+    // Abandon the search. The stop request is withdrawn once the worker has seen it, so it cannot cut
+    // short the next search
+    void stop() {
+        context.stopRequested = true;
+        if (worker.joinable()) worker.join();
+        context.stopRequested = false;
+        context.pondering = false;
+        move = NULL_MOVE;
+    }
+
+    // The opponent has moved in game. On the expected move, finish the search as a normal one and return
+    // true with its result; otherwise drop it
+    bool finish(const Position& game, SearchResult& found) {
+        if (move == NULL_MOVE) return false;
+        if (game.undoStack[game.gamePly - 1].move != move) {
+            stop();
+            return false;
+        }
+        ponderHit(context);
+        worker.join();
+        move = NULL_MOVE;
+        found = result;
+        return true;
+    }
+};
+
+// Read a move like "e2 e4" (or "e7 e8n" to underpromote) and play it if it is legal
+bool playInputMove(Position& pos, const string& moveInput) {
+    if ((moveInput.size() != 5 && moveInput.size() != 6) || moveInput[2] != ' ') {
+        cout << "Invalid input format. Use format 'e2 e4'.\n";
+        return false;
+    }
+
+    auto [fromSquare, toSquare] = parseInput(moveInput);
+    char promotion = moveInput.size() == 6 ? (char)tolower(moveInput[5]) : 'q';
+    Move move = findMove(pos, fromSquare, toSquare, promotion);
+    if (move == NULL_MOVE) {
+        return false;
+    }
+    makeMove(pos, move);
+    return true;
 }
 
 
 // Game loop for playing against the computer
-void computerGameLoop(bool humanPlaysWhite) {
-    bool isWhiteTurn = true;
-    initializePosition();
-    printBoardForPlayers();
+void computerGameLoop(bool humanPlaysWhite, SearchContext& context, const SearchLimits& limits) {
+    Position game;
+    initializePosition(game);
+    printBoardForPlayers(game);
+
+    // While the human thinks, search the position after the reply we expect from them
+    auto ponder = make_unique<PonderSearch>(context, limits);
+    SearchResult ponderResult = {NULL_MOVE, 0};
+    bool ponderResultReady = false;
 
     while (true) {
-        if (isCheckmateOrStalemate(isWhiteTurn)) {
-            if (isSquareAttacked(isWhiteTurn ? whiteKing : blackKing, !isWhiteTurn)) {
-                cout << (isWhiteTurn ? "Black wins by checkmate!" : "White wins by checkmate!") << endl;
+        trimHistory(game);
+        if (isCheckmateOrStalemate(game)) {
+            if (isInCheck(game)) {
+                cout << (game.isWhiteTurn ? "Black wins by checkmate!" : "White wins by checkmate!") << endl;
             } else {
                 cout << "Stalemate! The game is a draw." << endl;
             }
             break;
         }
 
-        if ((isWhiteTurn && humanPlaysWhite) || (!isWhiteTurn && !humanPlaysWhite)) {
+        if (game.isWhiteTurn == humanPlaysWhite) {
             // Human move
-            cout << (isWhiteTurn ? "White's turn: " : "Black's turn: ");
+            cout << (game.isWhiteTurn ? "White's turn: " : "Black's turn: ");
             string moveInput;
-            getline(cin, moveInput);
-
-            if (moveInput.size() != 5 || moveInput[2] != ' ') {
-                cout << "Invalid input format. Use format 'e2 e4'.\n";
-                continue;
-            }
+            if (!getline(cin, moveInput)) break;
 
-            pair<int, int> parsedMove = parseInput(moveInput);
-            int fromSquare = parsedMove.first;
-            int toSquare = parsedMove.second;
-
-            if (!makeMove(fromSquare, toSquare, isWhiteTurn)) {
+            if (!playInputMove(game, moveInput)) {
                 cout << "Invalid move. Try again.\n";
                 continue;
             }
+
+            // Keep the ponder search if the human played the expected move, otherwise drop it
+            ponderResultReady = ponder->finish(game, ponderResult);
         } else {
             // Computer move
             cout << "Computer is thinking...\n";
-            Move bestMove = findBestMove(isWhiteTurn);
-            if (bestMove.from == 0 && bestMove.to == 0) {
+            Move bookMove = openingBook.probe(game);
+            SearchResult bestMove = bookMove != NULL_MOVE ? SearchResult{bookMove, 0}
+                                  : ponderResultReady ? ponderResult : findBestMove(game, context, limits);
+            ponderResultReady = false;
+            if (bestMove.move == NULL_MOVE) {
                 cout << "No legal moves available for AI. Game over.\n";
                 break;
             }
-            makeMove(bestMove.from, bestMove.to, isWhiteTurn);
-            cout << "Computer's move: Evaluation = " << bestMove.evaluation << endl;
+            makeMove(game, bestMove.move);
+            if (bookMove != NULL_MOVE) cout << "Computer's move: " << moveToString(bestMove.move) << " (book)" << endl;
+            else cout << "Computer's move: " << moveToString(bestMove.move) << ", Evaluation = " << bestMove.evaluation << endl;
+
+            ponder->start(game);
         }
 
-        printBoardForPlayers();
-        isWhiteTurn = !isWhiteTurn;
+        printBoardForPlayers(game);
     }
 }
 
 
+// Ponder on the expected reply, then answer differently and check that the next search still reaches
+// its full depth; then ponder again and answer as expected, which must keep the ponder search's result
+bool runPonderCheck(SearchContext& context) {
+    SearchLimits limits;
+    limits.depth = 4;
+    auto game = make_unique<Position>();
+    initializePosition(*game);
+    auto ponder = make_unique<PonderSearch>(context, limits);
+
+    makeMove(*game, findBestMove(*game, context, limits, false).move);
+    ponder->start(*game);
+    if (ponder->move == NULL_MOVE) {
+        cout << "No expected reply to ponder on\n";
+        return false;
+    }
+    MoveList moves;
+    generateMoves(*game, moves);
+    makeMove(*game, moves[0] == ponder->move ? moves[1] : moves[0]);
+    SearchResult result;
+    bool ok = !ponder->finish(*game, result);
+    result = findBestMove(*game, context, limits, false);
+    if (context.lastSearchDepth != limits.depth) ok = false;
+    cout << "ponder miss: next search reached depth " << context.lastSearchDepth << " of " << limits.depth << "\n";
+
+    makeMove(*game, result.move);
+    ponder->start(*game);
+    if (ponder->move != NULL_MOVE) {
+        makeMove(*game, ponder->move);
+        bool kept = ponder->finish(*game, result) && result.move != NULL_MOVE && context.lastSearchDepth == limits.depth;
+        cout << "ponder hit: " << (kept ? "search kept" : "search lost") << "\n";
+        ok = ok && kept;
+    }
+    cout << (ok ? "Pondering check passed\n" : "Pondering check FAILED\n");
+    return ok;
+}
+
 // Game loop for human vs. human gameplay
 void gameLoop() {
-    bool isWhiteTurn = true;
-    initializePosition();
-    printBoardForPlayers();
+    Position game;
+    initializePosition(game);
+    printBoardForPlayers(game);
 
     while (true) {
-        if (isCheckmateOrStalemate(isWhiteTurn)) {
-            if (isSquareAttacked(isWhiteTurn ? whiteKing : blackKing, !isWhiteTurn)) {
-                cout << (isWhiteTurn ? "Black wins by checkmate!" : "White wins by checkmate!") << endl;
+        if (isCheckmateOrStalemate(game)) {
+            if (isInCheck(game)) {
+                cout << (game.isWhiteTurn ? "Black wins by checkmate!" : "White wins by checkmate!") << endl;
             } else {
                 cout << "Stalemate! The game is a draw." << endl;
             }
@@ -905,23 +4716,16 @@ void gameLoop() {
         }
 
         // Display turn and take input
-        cout << (isWhiteTurn ? "White's turn: " : "Black's turn: ");
+        cout << (game.isWhiteTurn ? "White's turn: " : "Black's turn: ");
         string moveInput;
-        getline(cin, moveInput);
-
-        if (moveInput.size() != 5 || moveInput[2] != ' ') {
-            cout << "Invalid input format. Use format 'e2 e4'.\n";
-            continue;
-        }
+        if (!getline(cin, moveInput)) break;
 
-        auto [fromSquare, toSquare] = parseInput(moveInput);
-        if (makeMove(fromSquare, toSquare, isWhiteTurn)) {
-            printBoardForPlayers();
-            int score = evaluatePosition();
+        if (playInputMove(game, moveInput)) {
+            printBoardForPlayers(game);
+            int score = evaluatePosition(game);
             cout << "Evaluation Score: " << score << " ("
                  << (score > 0 ? "White is better" : (score < 0 ? "Black is better" : "Equal"))
                  << ")\n";
-            isWhiteTurn = !isWhiteTurn;
         } else {
             cout << "Invalid move. Try again.\n";
         }
@@ -930,28 +4734,850 @@ void gameLoop() {
 
 
 
+// Parse a move in UCI coordinate notation (e2e4, e7e8q); NULL_MOVE if it is not legal here
+Move parseUciMove(const Position& pos, const string& text) {
+    if (text.size() < 4 || text[0] < 'a' || text[0] > 'h' || text[1] < '1' || text[1] > '8' ||
+        text[2] < 'a' || text[2] > 'h' || text[3] < '1' || text[3] > '8') {
+        return NULL_MOVE;
+    }
+    int fromSquare = (text[1] - '1') * 8 + (text[0] - 'a');
+    int toSquare = (text[3] - '1') * 8 + (text[2] - 'a');
+    return findMove(pos, fromSquare, toSquare, text.size() > 4 ? text[4] : 'q');
+}
+
+// Read a whole decimal number from outside input (a GUI option, an engine spec) into value, clamped to
+// [low, high]. Text that is not a number leaves value alone and returns false
+template <typename T>
+bool parseNumber(const string& text, T low, T high, T& value) {
+    T parsed;
+    auto [end, error] = from_chars(text.data(), text.data() + text.size(), parsed);
+    if (error == errc::result_out_of_range) parsed = text[0] == '-' ? low : high;
+    else if (error != errc() || end != text.data() + text.size()) return false;
+    value = clamp(parsed, low, high);
+    return true;
+}
+
+// Time for one move: an even share of the clock plus most of the increment, keeping 50 ms in hand
+int64_t allocateTime(int64_t remaining, int64_t increment, int movesToGo) {
+    int64_t budget = remaining / (movesToGo > 0 ? movesToGo : 30) + increment * 3 / 4;
+    return max(min(budget, remaining - 50), (int64_t)1);
+}
+
+// Runs on its own thread so the input loop can keep reading. With go infinite, or while still pondering,
+// the GUI only expects bestmove after it has sent stop (or ponderhit)
+void uciSearch(Position pos, SearchContext& context, SearchLimits limits, bool infinite) {
+    Move bookMove = infinite ? NULL_MOVE : openingBook.probe(pos);
+    SearchResult result = bookMove != NULL_MOVE ? SearchResult{bookMove, 0} : findBestMove(pos, context, limits, false);
+    while ((infinite || context.pondering.load()) && !context.stopRequested.load()) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    // Suggest pondering on the reply the search expects
+    string line = "bestmove " + moveToString(result.move);
+    if (result.move != NULL_MOVE) {
+        makeMove(pos, result.move);
+        Move reply = predictedMove(pos, context.transpositionTable);
+        if (reply != NULL_MOVE) line += " ponder " + moveToString(reply);
+    }
+    sendLine(line);
+}
+
+// Play a 2000-ply game of knight shuffles the way the UCI position command does, then search it;
+// the undo history must have been trimmed to stay clear of MAX_GAME_PLY
+bool runLongGameCheck(SearchContext& context) {
+    auto game = make_unique<Position>();
+    initializePosition(*game);
+    const char* shuffle[] = {"g1f3", "g8f6", "f3g1", "f6g8"};
+    for (int ply = 0; ply < 2000; ++ply) {
+        trimHistory(*game);
+        makeMove(*game, parseUciMove(*game, shuffle[ply % 4]));
+    }
+    SearchLimits limits;
+    limits.depth = 4;
+    bool ok = game->gamePly < MAX_GAME_PLY - GAME_PLY_HEADROOM &&
+              findBestMove(*game, context, limits, false).move != NULL_MOVE;
+    cout << "2000 plies played, " << game->gamePly << " undo records kept\n";
+    cout << (ok ? "Long game check passed\n" : "Long game check FAILED\n");
+    return ok;
+}
+
+// UCI protocol on stdin/stdout, starting with firstCommand if the caller already read one. The search
+// runs on a separate thread, so stop is handled within a few thousand nodes and isready is answered
+// even mid-search
+void uciLoop(SearchContext& context, const string& firstCommand = "") {
+    Position pos;
+    initializePosition(pos);
+    thread searchThread;
+    context.uciOutput = true;
+
+    auto stopSearch = [&]() {
+        context.stopRequested = true;
+        if (searchThread.joinable()) searchThread.join();
+        context.pondering = false;
+    };
+
+    for (string line = firstCommand; !line.empty() || getline(cin, line); line.clear()) {
+        LOG(LOG_DEBUG, LOG_IO, "< " << line);
+        istringstream input(line);
+        string command;
+        input >> command;
+
+        if (command == "uci") {
+            sendLine("id name MindStorm");
+            sendLine("id author MarcosAsh");
+            sendLine("option name Hash type spin default 16 min 1 max 65536");
+            sendLine("option name Threads type spin default 1 min 1 max 256");
+            sendLine("option name EvalFile type string default <empty>");
+            sendLine("option name Ponder type check default false");
+            sendLine("option name BookFile type string default <empty>");
+            sendLine("option name BookDepth type spin default 20 min 0 max 1024");
+            sendLine("option name BookBestMove type check default false");
+            sendLine("option name SyzygyPath type string default <empty>");
+            sendLine("option name SyzygyProbeLimit type spin default " + to_string(TB_MAX_PIECES) + " min 0 max " +
+                     to_string(TB_MAX_PIECES));
+            sendLine("option name PrincipalVariationSearch type check default true");
+            sendLine("option name NullMovePruning type check default true");
+            sendLine("option name LateMoveReductions type check default true");
+            sendLine("uciok");
+        } else if (command == "isready") {
+            sendLine("readyok");
+        } else if (command == "ucinewgame") {
+            stopSearch();
+            context.transpositionTable.clear();
+            for (PawnHashTable& pawnTable : context.pawnTables) pawnTable.clear();
+        } else if (command == "setoption") {
+            stopSearch();
+            string token, name, value;
+            input >> token; // "name"
+            while (input >> token && token != "value") name += (name.empty() ? "" : " ") + token;
+            getline(input >> ws, value);
+
+            // Spin values outside the advertised range are clamped to it; values that are not numbers are ignored
+            int number = 0;
+            auto spin = [&](int low, int high) {
+                if (parseNumber(value, low, high, number)) return true;
+                sendLine("info string ignoring " + name + " value " + value);
+                return false;
+            };
+            if (name == "Hash") {
+                if (spin(1, 65536)) {
+                    size_t megabytes = context.transpositionTable.resize(number);
+                    if (megabytes * 2 <= (size_t)number) {
+                        sendLine("info string not enough memory, Hash reduced to " + to_string(megabytes) + " MB");
+                    }
+                }
+            } else if (name == "Threads") {
+                if (spin(1, 256)) context.threads = number;
+            } else if (name == "EvalFile") {
+                if (value.empty() || value == "<empty>") useNnue = false;
+                else if (!loadNetwork(value)) sendLine("info string could not load " + value + ", using the classical evaluation");
+                resetHistory(pos); // Rebuild the accumulators for the new network
+            }
+            else if (name == "BookFile") {
+                if (value.empty() || value == "<empty>") openingBook.close();
+                else if (!openingBook.open(value)) sendLine("info string could not open book " + value);
+            } else if (name == "BookDepth") {
+                if (spin(0, 1024)) openingBook.maxPly = number;
+            } else if (name == "BookBestMove") openingBook.bestMove = value == "true";
+            else if (name == "SyzygyPath") initializeTablebases(value == "<empty>" ? "" : value);
+            else if (name == "SyzygyProbeLimit") {
+                if (spin(0, TB_MAX_PIECES)) tablebaseProbeLimit = number;
+            } else if (name == "PrincipalVariationSearch") context.options.principalVariationSearch = value == "true";
+            else if (name == "NullMovePruning") context.options.nullMovePruning = value == "true";
+            else if (name == "LateMoveReductions") context.options.lateMoveReductions = value == "true";
+        } else if (command == "position") {
+            stopSearch();
+            string token, fen;
+            input >> token;
+            if (token == "startpos") {
+                fen = START_FEN;
+                input >> token; // "moves", if present
+            } else if (token == "fen") {
+                while (input >> token && token != "moves") fen += (fen.empty() ? "" : " ") + token;
+            }
+            if (!setPositionFromFEN(pos, fen)) {
+                sendLine("info string invalid position, ignored");
+                continue;
+            }
+            while (input >> token) {
+                Move move = parseUciMove(pos, token);
+                if (move == NULL_MOVE) {
+                    sendLine("info string illegal move " + token);
+                    break;
+                }
+                trimHistory(pos);
+                makeMove(pos, move);
+            }
+        } else if (command == "go") {
+            stopSearch();
+            SearchLimits limits;
+            limits.depth = MAX_DEPTH;
+            int64_t clock[2] = {0, 0}, increment[2] = {0, 0};
+            int movesToGo = 0;
+            bool infinite = false, ponder = false;
+            string token;
+            while (input >> token) {
+                if (token == "depth") input >> limits.depth;
+                else if (token == "nodes") input >> limits.nodes;
+                else if (token == "movetime") input >> limits.timeMs;
+                else if (token == "wtime") input >> clock[0];
+                else if (token == "btime") input >> clock[1];
+                else if (token == "winc") input >> increment[0];
+                else if (token == "binc") input >> increment[1];
+                else if (token == "movestogo") input >> movesToGo;
+                else if (token == "infinite") infinite = true;
+                else if (token == "ponder") ponder = true;
+            }
+            int side = pos.isWhiteTurn ? 0 : 1;
+            if (!limits.timeMs && clock[side] > 0) limits.timeMs = allocateTime(clock[side], increment[side], movesToGo);
+
+            context.stopRequested = false;
+            context.pondering = ponder; // The position already includes the move being pondered on
+            searchThread = thread(uciSearch, pos, ref(context), limits, infinite);
+        } else if (command == "ponderhit") {
+            ponderHit(context);
+        } else if (command == "stop") {
+            stopSearch();
+        } else if (command == "quit") {
+            break;
+        }
+    }
+
+    stopSearch();
+    context.uciOutput = false;
+}
+
+// One EPD record: a position without move counters, followed by operations such as bm and id
+struct EpdRecord {
+    string fen;
+    string id;
+    vector<string> bestMoves; // bm operands, in SAN or coordinate notation
+};
+
+bool parseEpd(const string& line, EpdRecord& record) {
+    istringstream fields(line);
+    string placement, side, castling, enPassant;
+    if (!(fields >> placement >> side >> castling >> enPassant)) return false;
+    record.fen = placement + " " + side + " " + castling + " " + enPassant;
+
+    // Tolerate full FENs: two move counters before the operations
+    string rest;
+    getline(fields, rest);
+    istringstream counters(rest);
+    string halfmove, fullmove;
+    if (counters >> halfmove >> fullmove && all_of(halfmove.begin(), halfmove.end(), ::isdigit) &&
+        all_of(fullmove.begin(), fullmove.end(), ::isdigit)) {
+        record.fen += " " + halfmove + " " + fullmove;
+        getline(counters, rest);
+    }
+
+    istringstream operations(rest);
+    for (string operation; getline(operations, operation, ';');) {
+        istringstream words(operation);
+        string opcode, operand;
+        if (!(words >> opcode)) continue;
+        if (opcode == "bm") {
+            while (words >> operand) record.bestMoves.push_back(operand);
+        } else if (opcode == "id") {
+            getline(words >> ws, operand);
+            if (operand.size() >= 2 && operand.front() == '"' && operand.back() == '"') operand = operand.substr(1, operand.size() - 2);
+            record.id = operand;
+        }
+    }
+    return true;
+}
+
+// A JSON string literal
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Whether a bm operand names the move, ignoring check and annotation marks
+bool sameMove(const string& operand, const string& san, Move move) {
+    auto strip = [](string text) {
+        while (!text.empty() && string("+#!?").find(text.back()) != string::npos) text.pop_back();
+        return text;
+    };
+    return strip(operand) == strip(san) || operand == moveToString(move);
+}
+
+// Analyse every position of an EPD file on a pool of workers, each with its own search context, and print
+// one JSON line per position in input order. Workers read the next line when they become free, and a
+// result waits only until the results before it are written, so memory does not grow with the file.
+// The totals, and the solve rate over records with bm, go to stderr
+bool runBatch(const string& path, int workerCount, size_t hashMegabytes, int searchThreads, const SearchLimits& limits,
+              const SearchOptions& options) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "Could not open " << path << "\n";
+        return false;
+    }
+
+    mutex inputMutex, resultMutex;
+    size_t nextIndex = 0, nextToWrite = 0;
+    map<size_t, string> finished; // Results waiting for an earlier one
+    uint64_t totalNodes = 0;
+    size_t withBestMove = 0, solved = 0;
+    auto start = chrono::steady_clock::now();
+
+    auto work = [&]() {
+        SearchContext context(hashMegabytes);
+        context.threads = searchThreads;
+        context.options = options;
+        auto pos = make_unique<Position>();
+        while (true) {
+            string line;
+            size_t index;
+            {
+                lock_guard<mutex> lock(inputMutex);
+                do {
+                    if (!getline(file, line)) return;
+                } while (line.find_first_not_of(" \t\r") == string::npos || line[0] == '#');
+                index = nextIndex++;
+            }
+
+            EpdRecord record;
+            string json = "{\"index\":" + to_string(index);
+            uint64_t nodes = 0;
+            bool hasBestMove = false, isSolved = false;
+            if (!parseEpd(line, record) || !setPositionFromFEN(*pos, record.fen)) {
+                json += ",\"error\":\"invalid position\",\"line\":" + jsonString(line);
+            } else {
+                // Start every position from empty tables, as after ucinewgame, so its result does not depend
+                // on which positions this worker happened to search before
+                context.transpositionTable.clear();
+                for (PawnHashTable& pawnTable : context.pawnTables) pawnTable.clear();
+                auto searchStart = chrono::steady_clock::now();
+                SearchResult result = findBestMove(*pos, context, limits, false);
+                int64_t ms = (int64_t)(secondsSince(searchStart) * 1000);
+                nodes = context.lastSearchNodes;
+                string san = result.move != NULL_MOVE ? moveToSan(*pos, result.move) : "";
+                if (!record.id.empty()) json += ",\"id\":" + jsonString(record.id);
+                json += ",\"fen\":" + jsonString(record.fen) + ",\"bestmove\":" + jsonString(moveToString(result.move)) +
+                        ",\"san\":" + jsonString(san) + ",\"score\":" +
+                        jsonString(uciScore(result.evaluation, pos->isWhiteTurn)) +
+                        ",\"depth\":" + to_string(context.lastSearchDepth) + ",\"nodes\":" + to_string(nodes) +
+                        ",\"time_ms\":" + to_string(ms);
+                if (!record.bestMoves.empty()) {
+                    hasBestMove = true;
+                    json += ",\"bm\":[";
+                    for (size_t i = 0; i < record.bestMoves.size(); ++i) {
+                        json += (i ? "," : "") + jsonString(record.bestMoves[i]);
+                        isSolved |= result.move != NULL_MOVE && sameMove(record.bestMoves[i], san, result.move);
+                    }
+                    json += string("],\"solved\":") + (isSolved ? "true" : "false");
+                }
+            }
+            json += "}";
+
+            lock_guard<mutex> lock(resultMutex);
+            finished[index] = json;
+            totalNodes += nodes;
+            withBestMove += hasBestMove;
+            solved += isSolved;
+            for (auto next = finished.find(nextToWrite); next != finished.end(); next = finished.find(++nextToWrite)) {
+                cout << next->second << '\n';
+                finished.erase(next);
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < workerCount; ++i) workers.emplace_back(work);
+    for (thread& worker : workers) worker.join();
+    cout.flush();
+
+    double seconds = max(secondsSince(start), 1e-9);
+    cerr << "positions " << nextIndex << "  workers " << workerCount << "  time " << (int64_t)(seconds * 1000)
+         << " ms  positions/s " << fixed << setprecision(1) << nextIndex / seconds << "  nodes " << totalNodes << "  nps "
+         << (uint64_t)(totalNodes / seconds);
+    if (withBestMove) cerr << "  solved " << solved << "/" << withBestMove << " (" << solved * 100.0 / withBestMove << "%)";
+    cerr << "\n";
+    return true;
+}
+
+// One side of a self-play match
+struct EngineConfig {
+    string name;
+    SearchLimits limits;
+    SearchOptions options;
+    size_t hashMegabytes = 16;
+};
+
+// Apply "name:key=value,..." on top of a base configuration. Keys are depth, nodes, movetime, hash,
+// eval (classical or nnue) and the search switches pvs, nullmove and lmr (on or off); the name is optional
+bool parseEngineConfig(const string& spec, EngineConfig& config) {
+    string settings = spec;
+    size_t colon = spec.find(':');
+    if (colon != string::npos) {
+        config.name = spec.substr(0, colon);
+        settings = spec.substr(colon + 1);
+    }
+    istringstream pairs(settings);
+    for (string pair; getline(pairs, pair, ',');) {
+        if (pair.empty()) continue;
+        size_t equals = pair.find('=');
+        string key = pair.substr(0, equals), value = equals == string::npos ? "" : pair.substr(equals + 1);
+        bool parsed = true;
+        if (key == "depth") parsed = parseNumber(value, 1, MAX_DEPTH, config.limits.depth);
+        else if (key == "nodes") parsed = parseNumber(value, (uint64_t)0, UINT64_MAX, config.limits.nodes);
+        else if (key == "movetime") parsed = parseNumber(value, (int64_t)0, INT64_MAX, config.limits.timeMs);
+        else if (key == "hash") parsed = parseNumber(value, (size_t)1, (size_t)65536, config.hashMegabytes);
+        else if (key == "eval" && (value == "classical" || value == "nnue")) config.options.classicalEvaluation = value == "classical";
+        else if (key == "pvs" && (value == "on" || value == "off")) config.options.principalVariationSearch = value == "on";
+        else if (key == "nullmove" && (value == "on" || value == "off")) config.options.nullMovePruning = value == "on";
+        else if (key == "lmr" && (value == "on" || value == "off")) config.options.lateMoveReductions = value == "on";
+        else {
+            cout << "Unknown engine setting " << pair << "\n";
+            return false;
+        }
+        if (!parsed) {
+            cout << "Invalid value in engine setting " << pair << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Balanced positions a few plies in, used when no openings file is given
+const char* const MATCH_OPENINGS[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2",
+    "rnbqkbnr/ppp1pppp/8/3p4/3P4/8/PPP1PPPP/RNBQKBNR w KQkq - 0 2",
+    "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2",
+    "rnbqkb1r/pppp1ppp/4pn2/8/2PP4/8/PP2PPPP/RNBQKBNR w KQkq - 0 3",
+    "rnbqkbnr/pppp1ppp/4p3/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2",
+    "rnbqkbnr/pp1ppppp/2p5/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2",
+    "rnbqkbnr/pppp1ppp/8/4p3/2P5/8/PP1PPPPP/RNBQKBNR w KQkq - 0 2",
+    "rnbqkbnr/ppp1pppp/8/3p4/8/5N2/PPPPPPPP/RNBQKB1R w KQkq - 0 2",
+    "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+};
+
+const int MAX_MATCH_PLIES = 600; // Adjudicated as a draw; well inside MAX_GAME_PLY with search on top
+
+// Earlier positions of the game identical to this one: same side to move, no irreversible move since
+int repetitionCount(const Position& pos) {
+    int count = 0;
+    for (int ply = pos.gamePly - 2; ply >= max(pos.gamePly - (int)pos.halfmoveClock, 0); ply -= 2) {
+        count += pos.undoStack[ply].hash == pos.hash();
+    }
+    return count;
+}
+
+// Neither side can mate: bare kings, or a single minor piece
+bool insufficientMaterial(const Position& pos) {
+    uint64_t heavyAndPawns = pos.bitboards[WHITE_PAWN] | pos.bitboards[BLACK_PAWN] | pos.bitboards[WHITE_ROOK] |
+                             pos.bitboards[BLACK_ROOK] | pos.bitboards[WHITE_QUEEN] | pos.bitboards[BLACK_QUEEN];
+    return !heavyAndPawns && __builtin_popcountll(pos.allPieces) <= 3;
+}
+
+struct GameRecord {
+    string openingFen;
+    vector<string> sanMoves;
+    string result;      // "1-0", "0-1" or "1/2-1/2"
+    string termination; // Why the game ended, for the PGN
+};
+
+// Play out a game from pos, engines[0] moving for White. Each move is a fresh findBestMove on the mover's context
+void playGame(Position& pos, SearchContext* contexts[2], const EngineConfig* engines[2], GameRecord& record) {
+    while (true) {
+        MoveList moves;
+        generateMoves(pos, moves);
+        if (moves.size() == 0) {
+            bool mated = isInCheck(pos);
+            record.result = !mated ? "1/2-1/2" : (pos.isWhiteTurn ? "0-1" : "1-0");
+            record.termination = mated ? "checkmate" : "stalemate";
+            return;
+        }
+        const char* draw = pos.halfmoveClock >= 100 ? "fifty-move rule"
+                         : repetitionCount(pos) >= 2 ? "threefold repetition"
+                         : insufficientMaterial(pos) ? "insufficient material"
+                         : pos.gamePly >= MAX_MATCH_PLIES ? "adjudication" : nullptr;
+        if (draw) {
+            record.result = "1/2-1/2";
+            record.termination = draw;
+            return;
+        }
+
+        int side = pos.isWhiteTurn ? 0 : 1;
+        Move move = findBestMove(pos, *contexts[side], engines[side]->limits, false).move;
+        record.sanMoves.push_back(moveToSan(pos, move));
+        makeMove(pos, move);
+    }
+}
+
+string gameToPgn(const GameRecord& record, const string& white, const string& black, int round) {
+    ostringstream pgn;
+    pgn << "[Event \"MindStorm match\"]\n[Site \"local\"]\n[Round \"" << round << "\"]\n[White \"" << white
+        << "\"]\n[Black \"" << black << "\"]\n[Result \"" << record.result << "\"]\n";
+    if (record.openingFen != START_FEN) pgn << "[SetUp \"1\"]\n[FEN \"" << record.openingFen << "\"]\n";
+    pgn << "[Termination \"" << record.termination << "\"]\n\n";
+
+    // Number the moves from the opening's side to move and full-move counter, wrapping lines near 80 columns
+    istringstream fields(record.openingFen);
+    string placement, side, castling, enPassant;
+    int halfmove = 0, fullmove = 1;
+    fields >> placement >> side >> castling >> enPassant >> halfmove >> fullmove;
+    bool whiteToMove = side != "b";
+    string line;
+    auto append = [&](const string& token) {
+        if (!line.empty() && line.size() + 1 + token.size() > 79) {
+            pgn << line << "\n";
+            line.clear();
+        }
+        line += (line.empty() ? "" : " ") + token;
+    };
+    for (size_t i = 0; i < record.sanMoves.size(); ++i) {
+        if (whiteToMove) append(to_string(fullmove) + ". " + record.sanMoves[i]);
+        else append(i == 0 ? to_string(fullmove) + "... " + record.sanMoves[i] : record.sanMoves[i]);
+        if (!whiteToMove) fullmove++;
+        whiteToMove = !whiteToMove;
+    }
+    append(record.result);
+    pgn << line << "\n\n";
+    return pgn.str();
+}
+
+// Expected score of the stronger side for an Elo difference
+double eloToScore(double elo) {
+    return 1 / (1 + pow(10, -elo / 400));
+}
+
+double scoreToElo(double score) {
+    score = min(max(score, 1e-6), 1 - 1e-6);
+    return -400 * log10(1 / score - 1);
+}
+
+// Log-likelihood ratio of H1 (elo1) against H0 (elo0), using the normal approximation to the
+// trinomial win/draw/loss distribution as in the usual engine-testing frameworks
+double sprtLlr(int wins, int draws, int losses, double elo0, double elo1) {
+    double games = wins + draws + losses;
+    if (games == 0) return 0;
+    double score = (wins + draws / 2.0) / games;
+    double variance = (wins + draws / 4.0) / games - score * score;
+    if (variance <= 0) return 0;
+    double score0 = eloToScore(elo0), score1 = eloToScore(elo1);
+    return (score1 - score0) * (2 * score - score0 - score1) / (2 * variance / games);
+}
+
+// Engine A against engine B: game pairs from each opening with colors swapped, played concurrently with
+// one pair of search contexts per worker. Stops after maxGames or as soon as the SPRT of elo1 against
+// elo0 (alpha = beta = 0.05) reaches a decision. Returns false if an input could not be read
+bool runMatch(const EngineConfig& engineA, const EngineConfig& engineB, int maxGames, const string& openingsPath,
+              int workerCount, double elo0, double elo1, const string& pgnPath) {
+    vector<string> openings;
+    if (!openingsPath.empty()) {
+        ifstream file(openingsPath);
+        for (string line; getline(file, line);) {
+            EpdRecord record;
+            if (line.find_first_not_of(" \t\r") != string::npos && line[0] != '#' && parseEpd(line, record)) {
+                openings.push_back(record.fen);
+            }
+        }
+        if (openings.empty()) {
+            cout << "No openings in " << openingsPath << "\n";
+            return false;
+        }
+    } else {
+        openings.assign(begin(MATCH_OPENINGS), end(MATCH_OPENINGS));
+    }
+    ofstream pgn;
+    if (!pgnPath.empty()) {
+        pgn.open(pgnPath);
+        if (!pgn) {
+            cout << "Could not write " << pgnPath << "\n";
+            return false;
+        }
+    }
+
+    const double lowerBound = log(0.05 / 0.95), upperBound = log(0.95 / 0.05);
+    mutex resultMutex;
+    atomic<int> nextGame{0};
+    atomic<bool> decided{false};
+    int wins = 0, draws = 0, losses = 0; // Engine A's results
+    auto start = chrono::steady_clock::now();
+
+    auto report = [&]() {
+        int games = wins + draws + losses;
+        double score = games ? (wins + draws / 2.0) / games : 0.5;
+        double variance = games ? (wins + draws / 4.0) / games - score * score : 0;
+        double margin = games ? 1.96 * sqrt(max(variance, 0.0) / games) : 0;
+        double elo = scoreToElo(score);
+        double errorMargin = games ? (scoreToElo(min(score + margin, 1.0)) - scoreToElo(max(score - margin, 0.0))) / 2 : 0;
+        cout << "games " << games << "  +" << wins << " =" << draws << " -" << losses << "  elo " << fixed
+             << setprecision(1) << elo << " +- " << errorMargin << "  llr " << setprecision(2)
+             << sprtLlr(wins, draws, losses, elo0, elo1) << " (" << lowerBound << ", " << upperBound << ")  games/s "
+             << games / max(secondsSince(start), 1e-9) << endl;
+    };
+
+    auto work = [&]() {
+        SearchContext contextA(engineA.hashMegabytes), contextB(engineB.hashMegabytes);
+        contextA.options = engineA.options;
+        contextB.options = engineB.options;
+        auto pos = make_unique<Position>();
+        for (int game; !decided && (game = nextGame++) < maxGames;) {
+            // Both games of a pair start from the same opening: the built-in ones with two random plies added
+            int pair = game / 2;
+            const string& opening = openings[pair % openings.size()];
+            setPositionFromFEN(*pos, opening);
+            istringstream fields(opening);
+            string placement, side, castling, enPassant;
+            int halfmove = 0, fullmove = 1;
+            fields >> placement >> side >> castling >> enPassant >> halfmove >> fullmove;
+            int startPly = 2 * (max(fullmove, 1) - 1) + (side == "b");
+            if (openingsPath.empty()) {
+                mt19937 gen(pair);
+                for (int ply = 0; ply < 2; ++ply) {
+                    MoveList moves;
+                    generateMoves(*pos, moves);
+                    if (moves.size() == 0) break;
+                    makeMove(*pos, moves[gen() % moves.size()]);
+                }
+            }
+            GameRecord record;
+            record.openingFen = positionToFen(*pos, (startPly + pos->gamePly) / 2 + 1);
+            setPositionFromFEN(*pos, record.openingFen); // The opening moves are not part of the game
+
+            bool aIsWhite = game % 2 == 0;
+            SearchContext* contexts[2] = {aIsWhite ? &contextA : &contextB, aIsWhite ? &contextB : &contextA};
+            const EngineConfig* engines[2] = {aIsWhite ? &engineA : &engineB, aIsWhite ? &engineB : &engineA};
+            contextA.transpositionTable.clear();
+            contextB.transpositionTable.clear();
+            playGame(*pos, contexts, engines, record);
+
+            lock_guard<mutex> lock(resultMutex);
+            if (record.result == "1/2-1/2") draws++;
+            else if ((record.result == "1-0") == aIsWhite) wins++;
+            else losses++;
+            if (pgn.is_open()) pgn << gameToPgn(record, engines[0]->name, engines[1]->name, game + 1) << flush;
+            double llr = sprtLlr(wins, draws, losses, elo0, elo1);
+            if (!decided && (llr <= lowerBound || llr >= upperBound)) decided = true;
+            int played = wins + draws + losses;
+            if (played % 10 == 0 && played < maxGames && !decided) report();
+        }
+    };
+
+    cout << engineA.name << " vs " << engineB.name << ", up to " << maxGames << " games on " << workerCount
+         << " workers, SPRT elo0 " << elo0 << " elo1 " << elo1 << "\n";
+    vector<thread> workers;
+    for (int i = 0; i < workerCount; ++i) workers.emplace_back(work);
+    for (thread& worker : workers) worker.join();
+
+    report();
+    double llr = sprtLlr(wins, draws, losses, elo0, elo1);
+    cout << (llr >= upperBound ? "H1 accepted: " + engineA.name + " is stronger"
+             : llr <= lowerBound ? "H0 accepted: no gain of " + to_string((int)elo1) + " Elo"
+             : string("SPRT inconclusive")) << "\n";
+    return true;
+}
+
+// Read "<command> <depth> [fen...]" arguments; returns false on a bad FEN
+bool setPositionFromArgs(Position& pos, const vector<string>& args) {
+    string fen = START_FEN;
+    if (args.size() > 2) {
+        fen = args[2];
+        for (size_t i = 3; i < args.size(); ++i) fen += " " + args[i];
+    }
+    if (!setPositionFromFEN(pos, fen)) {
+        cout << "Invalid FEN: " << fen << "\n";
+        return false;
+    }
+    return true;
+}
+
 // Main function to choose game mode
-int main() {
+int main(int argc, char* argv[]) {
     initializeZobrist();
-    initializePosition();
-    printBitboard(whitePawns);
+    initializeEvaluation();
+    initializeSliderAttacks();
+    initializeLineTables();
+    initializeLateMoveReductions();
+    initializeTablebaseIndexing();
+
+    // Options may appear anywhere; what remains is the command and its arguments
+    size_t hashMegabytes = 16;
+    int threads = 1;
+    SearchLimits limits;
+    SearchOptions options;
+    string networkPath, bookPath, tablebaseDirectory, batchPath;
+    int batchWorkers = max((int)thread::hardware_concurrency(), 1);
+    bool depthGiven = false;
+    string engineSpecA, engineSpecB, pgnPath;
+    int concurrency = max((int)thread::hardware_concurrency(), 1);
+    double elo0 = 0, elo1 = 5;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--hash" && i + 1 < argc) hashMegabytes = stoul(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc) threads = max(stoi(argv[++i]), 1);
+        else if (arg == "--nodes" && i + 1 < argc) limits.nodes = stoull(argv[++i]);
+        else if (arg == "--movetime" && i + 1 < argc) limits.timeMs = stoll(argv[++i]);
+        else if (arg == "--depth" && i + 1 < argc) {
+            limits.depth = stoi(argv[++i]);
+            depthGiven = true;
+        }
+        else if (arg == "--nnue" && i + 1 < argc) networkPath = argv[++i];
+        else if (arg == "--book" && i + 1 < argc) bookPath = argv[++i];
+        else if (arg == "--book-depth" && i + 1 < argc) openingBook.maxPly = stoi(argv[++i]);
+        else if (arg == "--book-best") openingBook.bestMove = true;
+        else if (arg == "--tb-path" && i + 1 < argc) tablebaseDirectory = argv[++i];
+#ifdef CHESS_SEARCH_STATS
+        else if (arg == "--search-stats" && i + 1 < argc) searchStatsPath = argv[++i];
+#endif
+        else if (arg == "--batch" && i + 1 < argc) batchPath = argv[++i];
+        else if (arg == "--engine-a" && i + 1 < argc) engineSpecA = argv[++i];
+        else if (arg == "--engine-b" && i + 1 < argc) engineSpecB = argv[++i];
+        else if (arg == "--pgn" && i + 1 < argc) pgnPath = argv[++i];
+        else if (arg == "--concurrency" && i + 1 < argc) concurrency = max(stoi(argv[++i]), 1);
+        else if (arg == "--sprt" && i + 1 < argc && sscanf(argv[i + 1], "%lf,%lf", &elo0, &elo1) == 2) ++i;
+        else if (arg == "--batch-workers" && i + 1 < argc) batchWorkers = max(stoi(argv[++i]), 1);
+#if CHESS_LOG_LEVEL > 0
+        else if (arg == "--log-file" && i + 1 < argc) logPath = argv[++i];
+#endif
+        else if (arg == "--tb-limit" && i + 1 < argc) tablebaseProbeLimit = min(stoi(argv[++i]), TB_MAX_PIECES);
+        else if (arg == "--no-pvs") options.principalVariationSearch = false;
+        else if (arg == "--no-null-move") options.nullMovePruning = false;
+        else if (arg == "--no-lmr") options.lateMoveReductions = false;
+        else args.push_back(arg);
+    }
+    startLogging();
+    if (!networkPath.empty()) {
+        if (loadNetwork(networkPath)) cout << "Loaded network " << networkPath << " (" << NNUE_BACKEND_NAMES[nnueBackend] << ")\n";
+        else cout << "Could not load network " << networkPath << "; using the classical evaluation\n";
+    }
+    if (!bookPath.empty() && !openingBook.open(bookPath)) cout << "Could not open book " << bookPath << "\n";
+    initializeTablebases(tablebaseDirectory);
+    if (!batchPath.empty()) {
+        // A node or time budget alone should not be cut short by the default depth
+        if (!depthGiven && (limits.nodes || limits.timeMs)) limits.depth = MAX_DEPTH;
+        return runBatch(batchPath, batchWorkers, hashMegabytes, threads, limits, options) ? 0 : 1;
+    }
+    SearchContext context(hashMegabytes);
+    context.threads = threads;
+    context.options = options;
+    Position pos;
+    initializePosition(pos);
+
+    if (!args.empty() && args[0] == "verify-sliders") {
+        bool ok = verifySliderAttacks();
+        if (usePext) {
+            // Also check the magic-multiply indexing on BMI2 machines
+            initializeSliderAttacks(false);
+            ok = verifySliderAttacks() && ok;
+        }
+        cout << (ok ? "Slider attack tables match slideMove\n" : "Slider attack tables are wrong\n");
+        return ok ? 0 : 1;
+    }
+
+    // perft/divide <depth> [fen]: count move tree nodes from the start position or a FEN
+    if (args.size() > 1 && (args[0] == "perft" || args[0] == "divide")) {
+        if (!setPositionFromArgs(pos, args)) return 1;
+        if (args[0] == "perft") runPerft(pos, stoi(args[1]));
+        else divide(pos, stoi(args[1]));
+        return 0;
+    }
+
+    // long-game-check: a game longer than MAX_GAME_PLY plies must still be searchable
+    if (!args.empty() && args[0] == "long-game-check") {
+        return runLongGameCheck(context) ? 0 : 1;
+    }
+
+    // ponder-check: a ponder miss in the game against the computer must not cut the next search short
+    if (!args.empty() && args[0] == "ponder-check") {
+        return runPonderCheck(context) ? 0 : 1;
+    }
+
+    // book-check <fixture.bin>: Polyglot keys against the published examples, and moves from a small book
+    if (args.size() > 1 && args[0] == "book-check") {
+        return runBookCheck(args[1]) ? 0 : 1;
+    }
+
+    if (!args.empty() && args[0] == "perft-suite") {
+        return runPerftSuite() ? 0 : 1;
+    }
+
+    // tb-generate <directory> [men]: build the missing endgame tables, by default up to TB_GENERATE_MAX_PIECES men
+    if (args.size() > 1 && args[0] == "tb-generate") {
+        int men = args.size() > 2 ? stoi(args[2]) : TB_GENERATE_MAX_PIECES;
+        return generateTablebases(args[1], min(men, TB_GENERATE_MAX_PIECES)) ? 0 : 1;
+    }
+
+    // tb-check: summarize the tables under --tb-path and test them against known endgame results
+    if (!args.empty() && args[0] == "tb-check") {
+        return runTablebaseCheck() ? 0 : 1;
+    }
+
+    // tb-fixture-check: probe published tables under --tb-path against their published results
+    if (!args.empty() && args[0] == "tb-fixture-check") {
+        return runTablebaseFixtureCheck();
+    }
+
+    // search <depth> [fen]: run findBestMove once and report the result
+    if (args.size() > 1 && args[0] == "search") {
+        if (!setPositionFromArgs(pos, args)) return 1;
+        limits.depth = stoi(args[1]);
+        auto start = chrono::steady_clock::now();
+        findBestMove(pos, context, limits);
+        double seconds = secondsSince(start);
+        cout << "Search took " << (int64_t)(seconds * 1000) << " ms, " << context.lastSearchNodes << " nodes ("
+             << (uint64_t)(context.lastSearchNodes / seconds) << " nps), " << context.lastSearchQNodes << " in quiescence ("
+             << (context.lastSearchNodes ? context.lastSearchQNodes * 100 / context.lastSearchNodes : 0) << "%), "
+             << context.lastSearchTbHits << " tablebase hits\n";
+        return 0;
+    }
+
+    // eval-bench <evals> [fen]: evaluation throughput of the classical and NNUE backends
+    if (args.size() > 1 && args[0] == "eval-bench") {
+        if (!setPositionFromArgs(pos, args)) return 1;
+        return runEvalBenchmark(pos, stoi(args[1])) ? 0 : 1;
+    }
+
+    // match <games> [openings.epd]: engine A against engine B, each move searched with that engine's settings
+    if (args.size() > 1 && args[0] == "match") {
+        EngineConfig engineA{"A", limits, options, hashMegabytes}, engineB{"B", limits, options, hashMegabytes};
+        if (!parseEngineConfig(engineSpecA, engineA) || !parseEngineConfig(engineSpecB, engineB)) return 1;
+        return runMatch(engineA, engineB, stoi(args[1]), args.size() > 2 ? args[2] : "", concurrency, elo0, elo1, pgnPath)
+                   ? 0 : 1;
+    }
+
+    // smp-bench <depth> [fen]: Lazy SMP scaling over 1 to 16 threads
+    if (args.size() > 1 && args[0] == "smp-bench") {
+        if (!setPositionFromArgs(pos, args)) return 1;
+        limits.depth = stoi(args[1]);
+        runSmpBenchmark(pos, context, limits);
+        return 0;
+    }
+
+    if (!args.empty() && args[0] == "uci") {
+        uciLoop(context);
+        return 0;
+    }
+
+    printBitboard(pos.bitboards[WHITE_PAWN]);
     cout << "Welcome to Chess!\nChoose game mode:\n1. Human vs Human\n2. Human vs Computer\n";
-    int choice;
-    cin >> choice;
-    cin.ignore(); // To ignore the newline character left in the input buffer
+    string choice;
+    getline(cin, choice);
 
-    if (choice == 1) {
+    if (choice == "uci") {
+        // A GUI that starts the engine without arguments opens with "uci"
+        uciLoop(context, choice);
+    } else if (choice == "1") {
         gameLoop();
-    } else if (choice == 2) {
+    } else if (choice == "2") {
         cout << "Do you want to play as White? (y/n): ";
         char colorChoice;
         cin >> colorChoice;
         cin.ignore();
         bool humanPlaysWhite = (colorChoice == 'y' || colorChoice == 'Y');
-        computerGameLoop(humanPlaysWhite);
+        computerGameLoop(humanPlaysWhite, context, limits);
     } else {
         cout << "Invalid choice. Exiting program.\n";
     }
 
     return 0;
-}
\ No newline at end of file
+}